@@ -99,3 +99,218 @@
 #endif
 
 #endif  // CACHE_LINE_SIZE
+
+#ifndef _CACHE_ABERLLOC_HEADER
+#define _CACHE_ABERLLOC_HEADER
+#include <stddef.h>
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <sched.h>
+#include <sys/sysctl.h>
+#else
+#include <sched.h>
+#include <unistd.h>
+#endif
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+// Data cache geometry of the machine we run on, detected once. CACHE_LINE_SIZE above stays the compile time value for
+// struct layouts, the runtime values are for placement decisions. Fields the platform does not report stay 0.
+
+#define CACHE_LEVELS 3
+
+typedef struct CacheLevel {
+    size_t size_;
+    size_t ways_;
+    size_t line_size_;
+} CacheLevel;
+
+typedef struct CacheGeometry {
+    size_t     line_size_;             // Largest line size seen, never below CACHE_LINE_SIZE
+    CacheLevel levels_[CACHE_LEVELS];  // L1 data, L2, L3 (unified or data)
+} CacheGeometry;
+
+#define CACHE_GEOMETRY_UNSET   0
+#define CACHE_GEOMETRY_RUNNING 1
+#define CACHE_GEOMETRY_DONE    2
+
+static CacheGeometry CACHE_GEOMETRY;
+static int           CACHE_GEOMETRY_STATE = CACHE_GEOMETRY_UNSET;
+
+static void set_cache_level_(int level, size_t size, size_t ways, size_t line_size) {
+  // First source to report a level wins
+  if (level < 1 || level > CACHE_LEVELS || CACHE_GEOMETRY.levels_[level - 1].size_ != 0) {
+    return;
+  }
+  CACHE_GEOMETRY.levels_[level - 1].size_      = size;
+  CACHE_GEOMETRY.levels_[level - 1].ways_      = ways;
+  CACHE_GEOMETRY.levels_[level - 1].line_size_ = line_size;
+}
+
+#if defined(__linux__)
+static size_t read_cache_sysfs_(int index, const char* field) {
+  char  path[96];
+  char  text[32];
+  FILE* file;
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/%s", index, field);
+  file = fopen(path, "r");
+  if (file == NULL) {
+    return 0;
+  }
+  size_t value = 0;
+  if (fgets(text, sizeof(text), file) != NULL) {
+    char* c = text;
+    for (; *c >= '0' && *c <= '9'; c++) {
+      value = value * 10 + (size_t)(*c - '0');
+    }
+    value <<= *c == 'K' ? 10 : *c == 'M' ? 20 : 0;
+  }
+  fclose(file);
+  return value;
+}
+static int is_data_cache_sysfs_(int index) {
+  char  path[96];
+  char  text[16] = {0};
+  FILE* file;
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+  file = fopen(path, "r");
+  if (file == NULL) {
+    return 0;
+  }
+  int data = fgets(text, sizeof(text), file) != NULL && (text[0] == 'D' || text[0] == 'U');  // Data or Unified
+  fclose(file);
+  return data;
+}
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+// Deterministic cache parameters, leaf 4 on Intel, 0x8000001D on AMD. Same register layout for both.
+static void detect_cache_cpuid_(void) {
+  unsigned int leaf = 4, eax, ebx, ecx, edx;
+  if (!__get_cpuid_count(leaf, 0, &eax, &ebx, &ecx, &edx) || (eax & 0x1F) == 0) {
+    leaf = 0x8000001D;
+    if (__get_cpuid_max(0x80000000, NULL) < leaf) {
+      return;
+    }
+  }
+  for (unsigned int index = 0; index < 16 && __get_cpuid_count(leaf, index, &eax, &ebx, &ecx, &edx); index++) {
+    unsigned int type = eax & 0x1F;  // 1 data, 2 instruction, 3 unified
+    if (type == 0) {
+      break;
+    }
+    if (type == 2) {
+      continue;
+    }
+    size_t ways       = ((ebx >> 22) & 0x3FF) + 1;
+    size_t partitions = ((ebx >> 12) & 0x3FF) + 1;
+    size_t line_size  = (ebx & 0xFFF) + 1;
+    size_t sets       = (size_t)ecx + 1;
+    set_cache_level_((eax >> 5) & 0x7, ways * partitions * line_size * sets, ways, line_size);
+  }
+}
+#endif
+
+// Sources in order of trust: sysfs or the OS tables, sysconf, cpuid. Later ones only fill what is missing.
+static void Detect_CacheGeometry(void) {
+#if defined(_WIN32)
+  DWORD length = 0;
+  GetLogicalProcessorInformation(NULL, &length);
+  SYSTEM_LOGICAL_PROCESSOR_INFORMATION* info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION*)malloc(length);
+  if (info != NULL && GetLogicalProcessorInformation(info, &length)) {
+    for (DWORD i = 0; i < length / sizeof(*info); i++) {
+      CACHE_DESCRIPTOR* cache = &info[i].Cache;
+      if (info[i].Relationship == RelationCache && (cache->Type == CacheData || cache->Type == CacheUnified)) {
+        set_cache_level_(cache->Level, cache->Size, cache->Associativity, cache->LineSize);
+      }
+    }
+  }
+  free(info);
+#elif defined(__APPLE__)
+  size_t value  = 0;
+  size_t length = sizeof(value);
+  if (sysctlbyname("hw.l1dcachesize", &value, &length, NULL, 0) == 0) {
+    set_cache_level_(1, value, 0, 0);
+  }
+  length = sizeof(value);
+  if (sysctlbyname("hw.l2cachesize", &value, &length, NULL, 0) == 0) {
+    set_cache_level_(2, value, 0, 0);
+  }
+  length = sizeof(value);
+  if (sysctlbyname("hw.cachelinesize", &value, &length, NULL, 0) == 0) {
+    CACHE_GEOMETRY.line_size_ = value;
+  }
+#else
+#if defined(__linux__)
+  for (int index = 0; index < 8; index++) {
+    size_t level = read_cache_sysfs_(index, "level");
+    if (level == 0) {
+      break;
+    }
+    if (is_data_cache_sysfs_(index)) {
+      set_cache_level_((int)level, read_cache_sysfs_(index, "size"), read_cache_sysfs_(index, "ways_of_associativity"),
+                       read_cache_sysfs_(index, "coherency_line_size"));
+    }
+  }
+#endif
+#ifdef _SC_LEVEL1_DCACHE_LINESIZE
+  long size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+  if (size > 0) {
+    set_cache_level_(1, (size_t)size, (size_t)(sysconf(_SC_LEVEL1_DCACHE_ASSOC) > 0 ? sysconf(_SC_LEVEL1_DCACHE_ASSOC) : 0),
+                     (size_t)(sysconf(_SC_LEVEL1_DCACHE_LINESIZE) > 0 ? sysconf(_SC_LEVEL1_DCACHE_LINESIZE) : 0));
+  }
+  size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (size > 0) {
+    set_cache_level_(2, (size_t)size, (size_t)(sysconf(_SC_LEVEL2_CACHE_ASSOC) > 0 ? sysconf(_SC_LEVEL2_CACHE_ASSOC) : 0),
+                     (size_t)(sysconf(_SC_LEVEL2_CACHE_LINESIZE) > 0 ? sysconf(_SC_LEVEL2_CACHE_LINESIZE) : 0));
+  }
+  size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (size > 0) {
+    set_cache_level_(3, (size_t)size, (size_t)(sysconf(_SC_LEVEL3_CACHE_ASSOC) > 0 ? sysconf(_SC_LEVEL3_CACHE_ASSOC) : 0),
+                     (size_t)(sysconf(_SC_LEVEL3_CACHE_LINESIZE) > 0 ? sysconf(_SC_LEVEL3_CACHE_LINESIZE) : 0));
+  }
+#endif
+#endif
+#if defined(__i386__) || defined(__x86_64__)
+  detect_cache_cpuid_();
+#endif
+  // Anything that is not a sane power of two falls back to the compile time value
+  for (int level = 0; level < CACHE_LEVELS; level++) {
+    size_t line_size = CACHE_GEOMETRY.levels_[level].line_size_;
+    if (line_size > CACHE_GEOMETRY.line_size_ && line_size <= 4096 && __builtin_popcountll(line_size) == 1) {
+      CACHE_GEOMETRY.line_size_ = line_size;
+    }
+  }
+  if (CACHE_GEOMETRY.line_size_ < CACHE_LINE_SIZE || __builtin_popcountll(CACHE_GEOMETRY.line_size_) != 1) {
+    CACHE_GEOMETRY.line_size_ = CACHE_LINE_SIZE;
+  }
+}
+
+// Thread-safe. The first caller detects, callers racing with it wait until the geometry is published.
+static const CacheGeometry* Get_CacheGeometry(void) {
+  int state = __atomic_load_n(&CACHE_GEOMETRY_STATE, __ATOMIC_ACQUIRE);
+  if (state == CACHE_GEOMETRY_DONE) {
+    return &CACHE_GEOMETRY;
+  }
+  if (state == CACHE_GEOMETRY_UNSET &&
+      __atomic_compare_exchange_n(&CACHE_GEOMETRY_STATE, &state, CACHE_GEOMETRY_RUNNING, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+    Detect_CacheGeometry();
+    __atomic_store_n(&CACHE_GEOMETRY_STATE, CACHE_GEOMETRY_DONE, __ATOMIC_RELEASE);
+    return &CACHE_GEOMETRY;
+  }
+  while (__atomic_load_n(&CACHE_GEOMETRY_STATE, __ATOMIC_ACQUIRE) != CACHE_GEOMETRY_DONE) {
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+  }
+  return &CACHE_GEOMETRY;
+}
+
+static size_t _getCacheLineSize(void) {
+  return Get_CacheGeometry()->line_size_;
+}
+
+#endif
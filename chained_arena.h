@@ -0,0 +1,572 @@
+#ifndef _CHAINED_ARENA_HEADER
+#define _CHAINED_ARENA_HEADER
+// #include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "./guard.h"
+#include "./policy.h"
+#include "./pressure.h"
+#include "./profiler.h"
+#include "./static_arena.h"
+#include "./trace.h"
+#include "./utils.h"
+#ifdef _WIN32
+#ifdef __GNUC__
+#include <windows.h>
+// Compilation using msys2 env or similar
+#else
+#error "You need to compile with gcc."
+#endif
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+// Unbounded arena made of a chain of virtual reservations. When the top chunk is exhausted a new, larger one is linked
+// on top of it, so addresses never move and nothing is copied. Positions are (chunk, offset) pairs.
+// Single-threaded
+typedef struct ArenaChunk {
+    uint8_t*           memory_;          // Base pointer to the usable memory, right after the header page
+    uintptr_t          total_size_;      // Usable reserved size
+    uintptr_t          header_size_;
+    uintptr_t          position_;        // Saved position, only valid while the chunk is not the top chunk
+    uintptr_t          committed_size_;  // Saved commit, only valid while the chunk is not the top chunk
+    uintptr_t          index_;
+    struct ArenaChunk* prev_chunk_;
+} ArenaChunk;
+
+typedef struct ChainedArenaPos {
+    uintptr_t chunk_;
+    uintptr_t offset_;
+} ChainedArenaPos;
+
+typedef struct ChainedArena {
+    ArenaChunk* chunk_;   // Top chunk, the only one we bump in
+    uint8_t*    memory_;  // Cached from the top chunk
+    uintptr_t   position_;
+    uintptr_t   committed_size_;
+    uintptr_t   total_size_;
+    // pthread_mutex_t __arena_mutex;
+    int auto_align_;
+    size_t alignment_;
+    // Last released chunk, kept so that pushing and popping around a chunk boundary does not map and unmap every time
+    ArenaChunk*    spare_chunk_;
+    // Only holds the large blocks inherited from merged scratch spaces, the arena itself never needs them
+    LargeMemBlock* blocks_;
+    ArenaPolicy*   policy_;  // Commit growth and shrink inside each chunk, DEFAULT_POLICY unless set
+    uintptr_t      color_;   // First position in the bottom chunk. 0 unless built with ABERLLOC_CACHE_COLORING
+} ChainedArena;
+
+// Positions as a single comparable integer, for the tracer and guard sampling
+#define ENCODED_POS_CHAINED(arena) (((uint64_t)(arena)->chunk_->index_ << 48) | (arena)->position_)
+
+static ArenaChunk* Create_ArenaChunk(size_t chunk_size, uintptr_t index, ArenaChunk* prev_chunk) {
+  // Error code NULL if memory failed to allocate
+  size_t header_size = align_2pow(sizeof(ArenaChunk), _getPageSize());
+  size_t total_size;
+  if (align_2pow_overflow(chunk_size, _getPageSize(), &total_size) || total_size > SIZE_MAX - header_size) {
+    DEBUG_PRINT("Chunk size overflows");
+    return NULL;
+  }
+  uint8_t* mem = os_new_virtual_mapping_(header_size + total_size);
+  if (mem == NULL) {
+    return NULL;
+  }
+  if (os_commit_(mem, header_size + _getPageSize()) == ERROR_OS_MEMORY) {
+    if (os_free_(mem, header_size + total_size) == ERROR_OS_MEMORY) {
+      DEBUG_PRINT("Freeing new chunk did not work during creation. Virtual memory leaked.");
+    }
+    return NULL;
+  }
+  ArenaChunk* chunk      = (ArenaChunk*)mem;
+  chunk->memory_         = mem + header_size;
+  chunk->total_size_     = total_size;
+  chunk->header_size_    = header_size;
+  chunk->position_       = 0;
+  chunk->committed_size_ = _getPageSize();
+  chunk->index_          = index;
+  chunk->prev_chunk_     = prev_chunk;
+  os_protect_readonly(mem, header_size);
+  return chunk;
+}
+
+static void Destroy_ArenaChunk(ArenaChunk* chunk) {
+  uint8_t*  mem        = (uint8_t*)chunk;
+  uintptr_t total_size = chunk->header_size_ + chunk->total_size_;
+  os_protect_readwrite(mem, chunk->header_size_);
+  if (os_free_(mem, total_size) == ERROR_OS_MEMORY) {
+    DEBUG_PRINT("Freeing chunk did not work during destruction. Memory leaked.");
+  }
+}
+
+static void SaveState_ChainedArena(ChainedArena* arena) {
+  // Chunk headers are read-only while not being updated
+  ArenaChunk* chunk = arena->chunk_;
+  os_protect_readwrite(chunk, chunk->header_size_);
+  chunk->position_       = arena->position_;
+  chunk->committed_size_ = arena->committed_size_;
+  os_protect_readonly(chunk, chunk->header_size_);
+}
+
+static void LoadState_ChainedArena(ChainedArena* arena, ArenaChunk* chunk) {
+  arena->chunk_          = chunk;
+  arena->memory_         = chunk->memory_;
+  arena->position_       = chunk->position_;
+  arena->committed_size_ = chunk->committed_size_;
+  arena->total_size_     = chunk->total_size_;
+}
+
+static void ReleaseTopChunk_ChainedArena(ChainedArena* arena) {
+  // The top chunk becomes the spare, the old spare is unmapped
+  ArenaChunk* chunk = arena->chunk_;
+  SaveState_ChainedArena(arena);
+  LoadState_ChainedArena(arena, chunk->prev_chunk_);
+  if (arena->spare_chunk_ != NULL) {
+    Destroy_ArenaChunk(arena->spare_chunk_);
+  }
+  arena->spare_chunk_ = chunk;
+}
+
+static int Grow_ChainedArena(ChainedArena* arena, size_t bytes) {
+  size_t needed;
+  if (size_add_overflow(bytes, arena->alignment_, &needed)) {
+    DEBUG_PRINT("Push size overflows");
+    return ERROR_OS_MEMORY;
+  }
+  size_t chunk_size = extendPolicy(arena->total_size_);
+  if (chunk_size < needed) {
+    chunk_size = needed;
+  }
+  SaveState_ChainedArena(arena);
+  ArenaChunk* chunk = arena->spare_chunk_;
+  if (chunk != NULL && chunk->total_size_ >= needed) {
+    arena->spare_chunk_ = NULL;
+    os_protect_readwrite(chunk, chunk->header_size_);
+    chunk->position_   = 0;
+    chunk->index_      = arena->chunk_->index_ + 1;
+    chunk->prev_chunk_ = arena->chunk_;
+    os_protect_readonly(chunk, chunk->header_size_);
+  } else {
+    chunk = Create_ArenaChunk(chunk_size, arena->chunk_->index_ + 1, arena->chunk_);
+    if (chunk == NULL) {
+      DEBUG_PRINT("Failed chunk allocation");
+      return ERROR_OS_MEMORY;
+    }
+  }
+  LoadState_ChainedArena(arena, chunk);
+  if (arena->policy_->huge_pages_) {
+    os_advise_huge_pages_(arena->memory_, arena->total_size_);
+  }
+  return SUCCESS;
+}
+
+int Init_ChainedArena(ChainedArena* arena, size_t arena_size, size_t auto_align) {
+#ifdef DEBUG
+  if (arena == NULL || arena_size < _getPageSize()) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  arena->spare_chunk_ = NULL;
+  arena->blocks_      = NULL;
+  arena->policy_      = &DEFAULT_POLICY;
+  // arena->__parent     = NULL;
+  size_t word_size = WORD_SIZE;
+  if (auto_align > word_size && __builtin_popcountll(auto_align) == 1) {
+    arena->auto_align_ = TRUE;
+    arena->alignment_  = auto_align;
+  } else {
+    arena->auto_align_ = FALSE;
+    arena->alignment_  = word_size;
+  }
+  ArenaChunk* chunk = Create_ArenaChunk(arena_size, 0, NULL);
+  if (chunk == NULL) {
+    return ERROR_OS_MEMORY;
+  }
+  LoadState_ChainedArena(arena, chunk);
+  // Only the bottom chunk is colored, the chunks above it belong to the same arena
+  arena->color_    = NEXT_CACHE_COLOR();
+  arena->position_ = arena->color_;
+  TRACE_EVENT(TRACE_INIT, TRACE_CHAINED, arena, arena_size, auto_align);
+  return SUCCESS;
+}
+
+int Destroy_ChainedArena(ChainedArena* arena) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  TRACE_EVENT(TRACE_DESTROY, TRACE_CHAINED, arena, 0, 0);
+  GUARD_POP(arena, 0);
+  PROFILE_POP(arena, 0);
+  if (arena->blocks_ != NULL) {
+    Destroy_LargeMemBlocks(arena->blocks_);
+  }
+  ArenaChunk* chunk = arena->chunk_;
+  while (chunk != NULL) {
+    ArenaChunk* prev_chunk = chunk->prev_chunk_;
+    Destroy_ArenaChunk(chunk);
+    chunk = prev_chunk;
+  }
+  if (arena->spare_chunk_ != NULL) {
+    Destroy_ArenaChunk(arena->spare_chunk_);
+  }
+
+  arena->chunk_          = NULL;
+  arena->spare_chunk_    = NULL;
+  arena->blocks_         = NULL;
+  arena->memory_         = NULL;
+  arena->total_size_     = 0;
+  arena->committed_size_ = 0;
+  arena->position_       = 0;
+  arena->auto_align_     = 0;
+  arena->alignment_      = 0;
+  return SUCCESS;
+}
+
+int SetAutoAlign2Pow_ChainedArena(ChainedArena* arena, size_t alignment) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+  if (__builtin_popcountll(alignment) != 1 || alignment < WORD_SIZE) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  arena->auto_align_ = TRUE;
+  arena->alignment_  = alignment;
+  return SUCCESS;
+}
+
+int SetPolicy_ChainedArena(ChainedArena* arena, ArenaPolicy* policy) {
+#ifdef DEBUG
+  if (arena == NULL || policy == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  // Only affects commits inside each chunk, chunk reservations keep growing geometrically
+  arena->policy_ = policy;
+  if (policy->huge_pages_ && os_advise_huge_pages_(arena->memory_, arena->total_size_) == ERROR_OS_MEMORY) {
+    DEBUG_PRINT("Huge page advice failed, continuing with regular pages");
+  }
+  return SUCCESS;
+}
+
+int ExtendCommit_ChainedArena(ChainedArena* arena, size_t total_commited_size) {
+#ifdef DEBUG
+  if (!arena || !total_commited_size || total_commited_size < arena->committed_size_) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  // Chunks never remap, a push that does not fit links a new chunk before getting here
+  if (total_commited_size > arena->total_size_) {
+    total_commited_size = arena->total_size_;
+  }
+  if (os_commit_(arena->memory_, total_commited_size) == ERROR_OS_MEMORY) {
+    return ERROR_OS_MEMORY;
+  }
+  arena->committed_size_ = total_commited_size;
+  return SUCCESS;
+}
+int ReduceCommit_ChainedArena(ChainedArena* arena, size_t total_commited_size) {
+#ifdef DEBUG
+  if (!arena || !total_commited_size || total_commited_size > arena->committed_size_) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  if (os_uncommit_(arena->memory_ + total_commited_size, arena->committed_size_ - total_commited_size) == ERROR_OS_MEMORY) {
+    return ERROR_OS_MEMORY;
+  }
+  arena->committed_size_ = total_commited_size;
+  return SUCCESS;
+}
+static void ShrinkCommit_ChainedArena(ChainedArena* arena, uintptr_t previous_position) {
+  size_t target = arena->policy_->reduce_(arena->policy_, arena->committed_size_, previous_position, arena->position_);
+  target        = pressure_commit_(target, arena->position_);
+  if (target < arena->committed_size_) {
+    if (ReduceCommit_ChainedArena(arena, target) == ERROR_OS_MEMORY) {
+      DEBUG_PRINT("Reduce commit in Chained arena failed");
+    }
+  }
+  if (arena->spare_chunk_ != NULL && PRESSURE_LEVEL() == PRESSURE_CRITICAL) {
+    Destroy_ArenaChunk(arena->spare_chunk_);
+    arena->spare_chunk_ = NULL;
+  }
+}
+
+// Decommits everything above the position and unmaps the spare chunk now, for arenas that sit idle under pressure.
+// Chunks below the top one keep their commit, they are only reached again by popping.
+int Trim_ChainedArena(ChainedArena* arena) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  if (arena->spare_chunk_ != NULL) {
+    Destroy_ArenaChunk(arena->spare_chunk_);
+    arena->spare_chunk_ = NULL;
+  }
+  size_t keep = arena->position_ < _getPageSize() ? _getPageSize() : align_2pow(arena->position_, _getPageSize());
+  if (keep < arena->committed_size_) {
+    return ReduceCommit_ChainedArena(arena, keep);
+  }
+  return SUCCESS;
+}
+
+ChainedArenaPos GetPos_ChainedArena(ChainedArena* arena) {
+  ChainedArenaPos pos = {arena->chunk_->index_, arena->position_};
+  return pos;
+}
+
+int PushAligner_ChainedArena(ChainedArena* arena, size_t alignment) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+  if (__builtin_popcountll(alignment) != 1 || alignment < WORD_SIZE) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  // Chunk memory is page aligned, so aligning the offset aligns the address
+  arena->position_ = align_2pow(arena->position_, alignment);
+  return SUCCESS;
+}
+
+int PushAlignerCacheLine_ChainedArena(ChainedArena* arena) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  arena->position_ = align_2pow(arena->position_, _getCacheLineSize());
+  return SUCCESS;
+}
+int PushAlignerPageSize_ChainedArena(ChainedArena* arena) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  arena->position_ = align_2pow(arena->position_, _getPageSize());
+  return SUCCESS;
+}
+uint8_t* PushNoZero_ChainedArena(ChainedArena* arena, size_t bytes) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return NULL;
+  }
+#endif
+  if (arena->auto_align_) {
+    PushAligner_ChainedArena(arena, arena->alignment_);
+  }
+  if (!fits_below(arena->position_, bytes, arena->total_size_)) {
+    if (Grow_ChainedArena(arena, bytes) == ERROR_OS_MEMORY) {
+      return NULL;
+    }
+  }
+  if (arena->position_ + bytes > arena->committed_size_) {
+    if (ExtendCommit_ChainedArena(arena, arena->policy_->extend_(arena->policy_, arena->committed_size_, arena->position_ + bytes)) ==
+        ERROR_OS_MEMORY) {
+      return NULL;
+    }
+  }
+  uint8_t* mem = arena->memory_ + arena->position_;
+  PROFILE_PUSH(arena, ENCODED_POS_CHAINED(arena), bytes);
+  GUARD_SAMPLE(arena, ENCODED_POS_CHAINED(arena), mem, bytes, arena->alignment_);
+  arena->position_ += bytes;
+  TRACE_EVENT(TRACE_PUSH_NO_ZERO, TRACE_CHAINED, arena, bytes, ENCODED_POS_CHAINED(arena));
+  return mem;
+}
+uint8_t* Push_ChainedArena(ChainedArena* arena, size_t bytes) {
+  TRACE_MUTE();
+  uint8_t* mem = PushNoZero_ChainedArena(arena, bytes);
+  TRACE_UNMUTE();
+  TRACE_EVENT(TRACE_PUSH, TRACE_CHAINED, arena, bytes, ENCODED_POS_CHAINED(arena));
+  if (mem != NULL) {
+    memset(mem, 0, bytes);
+  }
+  return mem;
+}
+
+// For data written by one thread while others write next to it: starts on its own cache line and is padded to whole
+// lines, so that the next push cannot share one with it. Zeroed.
+uint8_t* PushCrossThread_ChainedArena(ChainedArena* arena, size_t bytes) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return NULL;
+  }
+#endif
+  size_t alignment = _getCrossThreadAlignment();
+  if (align_2pow_overflow(bytes, alignment, &bytes)) {
+    return NULL;
+  }
+  PushAligner_ChainedArena(arena, alignment);
+  return Push_ChainedArena(arena, bytes);
+}
+
+int Pop_ChainedArena(ChainedArena* arena, uintptr_t bytes) {
+  // Same caveat as the other arenas with auto align. Popping through the bottom of a chunk continues from the saved top
+  // of the chunk below it, the unused tail of that chunk does not count.
+#ifdef DEBUG
+  if (arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  while (arena->position_ < bytes && arena->chunk_->prev_chunk_ != NULL) {
+    bytes -= arena->position_;
+    ReleaseTopChunk_ChainedArena(arena);
+  }
+  uintptr_t previous_position = arena->position_;
+  uintptr_t bottom             = arena->chunk_->prev_chunk_ == NULL ? arena->color_ : 0;
+  if (arena->position_ - bottom < bytes) {
+    bytes = arena->position_ - bottom;
+  }
+  arena->position_ -= bytes;
+  GUARD_POP(arena, ENCODED_POS_CHAINED(arena));
+  PROFILE_POP(arena, ENCODED_POS_CHAINED(arena));
+  TRACE_EVENT(TRACE_POP, TRACE_CHAINED, arena, bytes, ENCODED_POS_CHAINED(arena));
+  ShrinkCommit_ChainedArena(arena, previous_position);
+  return SUCCESS;
+}
+int PopTo_ChainedArena(ChainedArena* arena, ChainedArenaPos position) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  while (arena->chunk_->index_ > position.chunk_) {
+    ReleaseTopChunk_ChainedArena(arena);
+  }
+  uintptr_t previous_position = arena->position_;
+  if (arena->chunk_->index_ == position.chunk_ && position.offset_ < arena->position_) {
+    uintptr_t bottom  = arena->chunk_->prev_chunk_ == NULL ? arena->color_ : 0;
+    arena->position_ = position.offset_ > bottom ? position.offset_ : bottom;
+  }
+  GUARD_POP(arena, ENCODED_POS_CHAINED(arena));
+  PROFILE_POP(arena, ENCODED_POS_CHAINED(arena));
+  TRACE_EVENT(TRACE_POP_TO, TRACE_CHAINED, arena, 0, ENCODED_POS_CHAINED(arena));
+  ShrinkCommit_ChainedArena(arena, previous_position);
+  return SUCCESS;
+}
+int PopToAdress_ChainedArena(ChainedArena* arena, uint8_t* address) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  address = GUARD_ADDRESS(arena, address);
+  // Find the chunk owning the address before releasing anything
+  ArenaChunk* chunk = arena->chunk_;
+  while (chunk != NULL && (address < chunk->memory_ || address > chunk->memory_ + chunk->total_size_)) {
+    chunk = chunk->prev_chunk_;
+  }
+  if (chunk == NULL) {
+    DEBUG_PRINT("Address is outside the memory in use in PopToAddress");
+    return SUCCESS;
+  }
+  ChainedArenaPos position = {chunk->index_, (uintptr_t)(address - chunk->memory_)};
+  return PopTo_ChainedArena(arena, position);
+}
+
+int Clear_ChainedArena(ChainedArena* arena) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  while (arena->chunk_->prev_chunk_ != NULL) {
+    ReleaseTopChunk_ChainedArena(arena);
+  }
+  uintptr_t previous_position = arena->position_;
+  arena->position_            = arena->color_;
+  GUARD_POP(arena, 0);
+  PROFILE_POP(arena, 0);
+  ShrinkCommit_ChainedArena(arena, previous_position);
+  if (arena->blocks_ != NULL) {
+    Destroy_LargeMemBlocks(arena->blocks_);
+    arena->blocks_ = NULL;
+  }
+  TRACE_EVENT(TRACE_CLEAR, TRACE_CHAINED, arena, 0, 0);
+  return SUCCESS;
+}
+
+// The scratch space is always carved from the top chunk, so destroying or merging it never crosses chunks.
+int InitScratch_ChainedArena(StaticArena* scratch_space, ChainedArena* parent_arena, size_t arena_size, size_t auto_align) {
+#ifdef DEBUG
+  if (scratch_space == NULL || parent_arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  GUARD_SUSPEND();
+  PROFILE_SUSPEND();
+  uint8_t* mem = PushNoZero_ChainedArena(parent_arena, arena_size);
+  PROFILE_RESUME();
+  GUARD_RESUME();
+  if (mem == NULL) {
+    return ERROR_OS_MEMORY;
+  }
+
+  scratch_space->memory_ = mem;
+
+  scratch_space->total_size_ = arena_size;
+  scratch_space->position_   = 0;
+  scratch_space->color_      = 0;
+
+  scratch_space->blocks_      = NULL;
+  scratch_space->blocks_tail_ = NULL;
+
+  size_t word_size = WORD_SIZE;
+  if (auto_align > word_size && __builtin_popcountll(auto_align) == 1) {
+    scratch_space->auto_align_ = TRUE;
+    scratch_space->alignment_  = auto_align;
+  } else {
+    scratch_space->auto_align_ = FALSE;
+    scratch_space->alignment_  = word_size;
+  }
+  TRACE_EVENT_FLAGS(TRACE_INIT_SCRATCH, TRACE_STATIC, scratch_space, (uintptr_t)parent_arena, arena_size,
+                    scratch_space->auto_align_ ? __builtin_ctzll(scratch_space->alignment_) : 0);
+  return SUCCESS;
+}
+int DestroyScratch_ChainedArena(StaticArena* scratch_space, ChainedArena* parent_arena) {
+  // Make sure you destroy arenas in reverse order on which you created them for correctness.
+  uintptr_t previous_position = parent_arena->position_;
+  parent_arena->position_     = (uintptr_t)scratch_space->memory_ - (uintptr_t)parent_arena->memory_;
+  scratch_space->memory_      = NULL;
+  GUARD_POP(scratch_space, 0);
+  PROFILE_POP(scratch_space, 0);
+  TRACE_EVENT(TRACE_DESTROY_SCRATCH, TRACE_STATIC, scratch_space, (uintptr_t)parent_arena, ENCODED_POS_CHAINED(parent_arena));
+
+  if (scratch_space->blocks_ != NULL) {
+    Destroy_LargeMemBlocks(scratch_space->blocks_);
+  }
+  scratch_space->blocks_      = NULL;
+  scratch_space->blocks_tail_ = NULL;
+
+  scratch_space->total_size_ = 0;
+  scratch_space->position_   = 0;
+  scratch_space->auto_align_ = 0;
+  scratch_space->alignment_  = 0;
+  ShrinkCommit_ChainedArena(parent_arena, previous_position);
+  return SUCCESS;
+}
+int MergeScratch_ChainedArena(StaticArena* scratch_space, ChainedArena* parent_arena) {
+  // Set the new position to conserve the memory from the scratch space and null properties
+  GUARD_MERGE(scratch_space, parent_arena,
+              ((uint64_t)parent_arena->chunk_->index_ << 48) | ((uintptr_t)scratch_space->memory_ - (uintptr_t)parent_arena->memory_));
+  PROFILE_MERGE(scratch_space, parent_arena,
+              ((uint64_t)parent_arena->chunk_->index_ << 48) | ((uintptr_t)scratch_space->memory_ - (uintptr_t)parent_arena->memory_));
+  parent_arena->position_ = ((uintptr_t)scratch_space->memory_ - (uintptr_t)parent_arena->memory_) + scratch_space->position_;
+  scratch_space->memory_  = NULL;
+  TRACE_EVENT(TRACE_MERGE_SCRATCH, TRACE_STATIC, scratch_space, (uintptr_t)parent_arena, ENCODED_POS_CHAINED(parent_arena));
+
+  parent_arena->blocks_       = Splice_LargeMemBlocks(scratch_space->blocks_, scratch_space->blocks_tail_, parent_arena->blocks_);
+  scratch_space->blocks_      = NULL;
+  scratch_space->blocks_tail_ = NULL;
+
+  scratch_space->total_size_ = 0;
+  scratch_space->position_   = 0;
+  scratch_space->auto_align_ = 0;
+  scratch_space->alignment_  = 0;
+  return SUCCESS;
+}
+
+#endif
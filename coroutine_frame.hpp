@@ -0,0 +1,209 @@
+#ifndef _COROUTINE_FRAME_ABERLLOC_HEADER
+#define _COROUTINE_FRAME_ABERLLOC_HEADER
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include "./utils.h"
+#include "./virtual_arena.h"
+// C++20 coroutine frames from arenas instead of the global heap. A promise_type inherits ArenaFramePromise, and its
+// frames come from, in order:
+//   - the arena passed to the coroutine as (std::allocator_arg, VirtualArena*, ...), after `this` for members,
+//   - the thread's current arena, set with a FrameArenaScope,
+//   - the thread's frame pool: size classes with free lists, carved from a per-thread virtual arena.
+// Arena frames are popped when they are the top of their arena (LIFO, the common case for nested awaits), the others
+// go back with the arena's next pop or clear. Pool frames may be destroyed on any thread, a frame freed away from its
+// pool goes through a lock-free list that the owner drains on its next allocation.
+// Frames larger than the biggest class use the global operator new.
+
+#define FRAME_MIN_SHIFT  6   // 64 bytes
+#define FRAME_CLASSES    9   // Up to 16 KiB
+#define FRAME_POOL_SIZE  SMALL_SIZE_ARENA
+#define FRAME_ALIGNMENT  __STDCPP_DEFAULT_NEW_ALIGNMENT__
+
+enum FrameKind : uint32_t { FRAME_ARENA, FRAME_POOL, FRAME_GLOBAL };
+
+// In front of every frame, keeps the frame at FRAME_ALIGNMENT
+struct alignas(FRAME_ALIGNMENT) FrameHeader {
+    void*        owner_;  // VirtualArena or FramePool
+    FrameKind    kind_;
+    uint32_t     class_;
+    FrameHeader* next_;   // Free and remote lists
+};
+
+struct FramePool {
+    VirtualArena arena_;  // Never popped, freed frames are reused through the lists
+    FrameHeader* free_[FRAME_CLASSES];
+    size_t       live_;
+    // Frames freed on other threads, on its own line
+    FrameHeader* remote_ __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+inline thread_local VirtualArena* CURRENT_FRAME_ARENA = nullptr;
+
+static inline uint32_t Class_FramePool(size_t bytes) {
+  uint32_t shift = bytes <= ((size_t)1 << FRAME_MIN_SHIFT) ? FRAME_MIN_SHIFT : 64 - __builtin_clzll(bytes - 1);
+  return shift - FRAME_MIN_SHIFT;
+}
+
+static void DrainRemote_FramePool(FramePool* pool) {
+  FrameHeader* frame = __atomic_exchange_n(&pool->remote_, nullptr, __ATOMIC_ACQUIRE);
+  while (frame != nullptr) {
+    FrameHeader* next         = frame->next_;
+    frame->next_              = pool->free_[frame->class_];
+    pool->free_[frame->class_] = frame;
+    pool->live_--;
+    frame = next;
+  }
+}
+
+// The pool lives at the bottom of its own arena, so that frames freed after its thread exited still have a list to
+// land on. The arena is only unmapped at thread exit when no frame is live.
+struct FramePoolOwner {
+    FramePool* pool_ = nullptr;
+    ~FramePoolOwner() {
+      if (pool_ == nullptr) {
+        return;
+      }
+      DrainRemote_FramePool(pool_);
+      if (pool_->live_ == 0) {
+        VirtualArena arena = pool_->arena_;
+        Destroy_VirtualArena(&arena);
+      }
+    }
+};
+inline thread_local FramePoolOwner FRAME_POOL_OWNER;
+
+static FramePool* Current_FramePool() {
+  if (FRAME_POOL_OWNER.pool_ != nullptr) {
+    return FRAME_POOL_OWNER.pool_;
+  }
+  VirtualArena arena;
+  if (Init_VirtualArena(&arena, FRAME_POOL_SIZE, FRAME_ALIGNMENT, FALSE) != SUCCESS) {
+    return nullptr;
+  }
+  PushAligner_VirtualArena(&arena, CACHE_LINE_SIZE);
+  FramePool* pool = (FramePool*)Push_VirtualArena(&arena, sizeof(FramePool));
+  if (pool == nullptr) {
+    Destroy_VirtualArena(&arena);
+    return nullptr;
+  }
+  // From here on the copy inside the pool is the arena
+  pool->arena_           = arena;
+  FRAME_POOL_OWNER.pool_ = pool;
+  return pool;
+}
+
+static void* Alloc_FramePool(size_t size) {
+  size_t bytes = size + sizeof(FrameHeader);
+  if (bytes > ((size_t)1 << (FRAME_MIN_SHIFT + FRAME_CLASSES - 1))) {
+    FrameHeader* frame = (FrameHeader*)::operator new(bytes);
+    frame->kind_       = FRAME_GLOBAL;
+    return frame + 1;
+  }
+  FramePool* pool = Current_FramePool();
+  if (pool == nullptr) {
+    throw std::bad_alloc();
+  }
+  uint32_t size_class = Class_FramePool(bytes);
+  if (pool->free_[size_class] == nullptr && __atomic_load_n(&pool->remote_, __ATOMIC_RELAXED) != nullptr) {
+    DrainRemote_FramePool(pool);
+  }
+  FrameHeader* frame = pool->free_[size_class];
+  if (frame != nullptr) {
+    pool->free_[size_class] = frame->next_;
+  } else {
+    frame = (FrameHeader*)PushNoZero_VirtualArena(&pool->arena_, (size_t)1 << (size_class + FRAME_MIN_SHIFT));
+    if (frame == nullptr) {
+      throw std::bad_alloc();
+    }
+    frame->owner_ = pool;
+    frame->kind_  = FRAME_POOL;
+    frame->class_ = size_class;
+  }
+  pool->live_++;
+  return frame + 1;
+}
+
+static void* Alloc_FrameArena(VirtualArena* arena, size_t size) {
+  PushAligner_VirtualArena(arena, FRAME_ALIGNMENT);
+  FrameHeader* frame = (FrameHeader*)PushNoZero_VirtualArena(arena, size + sizeof(FrameHeader));
+  if (frame == nullptr) {
+    throw std::bad_alloc();
+  }
+  frame->owner_ = arena;
+  frame->kind_  = FRAME_ARENA;
+  return frame + 1;
+}
+
+static void Free_Frame(void* memory, size_t size) {
+  FrameHeader* frame = (FrameHeader*)memory - 1;
+  switch (frame->kind_) {
+    case FRAME_ARENA: {
+      // Only the top frame can go back right away
+      VirtualArena* arena = (VirtualArena*)frame->owner_;
+      if ((uint8_t*)memory + size == arena->memory_ + arena->position_) {
+        PopTo_VirtualArena(arena, (uintptr_t)((uint8_t*)frame - arena->memory_));
+      } else if (arena->blocks_ != nullptr && arena->blocks_->memory_ == (uint8_t*)frame) {
+        PopLargeBlock_VirtualArena(arena);
+      }
+      break;
+    }
+    case FRAME_POOL: {
+      FramePool* pool = (FramePool*)frame->owner_;
+      if (pool == FRAME_POOL_OWNER.pool_) {
+        frame->next_              = pool->free_[frame->class_];
+        pool->free_[frame->class_] = frame;
+        pool->live_--;
+        break;
+      }
+      FrameHeader* head = __atomic_load_n(&pool->remote_, __ATOMIC_RELAXED);
+      do {
+        frame->next_ = head;
+      } while (!__atomic_compare_exchange_n(&pool->remote_, &head, frame, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+      break;
+    }
+    case FRAME_GLOBAL:
+      ::operator delete(frame);
+      break;
+  }
+}
+
+// Routes the frames of the coroutines created on this thread to an arena while in scope. Scopes nest.
+struct FrameArenaScope {
+    VirtualArena* previous_;
+    explicit FrameArenaScope(VirtualArena* arena) : previous_(CURRENT_FRAME_ARENA) { CURRENT_FRAME_ARENA = arena; }
+    ~FrameArenaScope() { CURRENT_FRAME_ARENA = previous_; }
+    FrameArenaScope(const FrameArenaScope&)            = delete;
+    FrameArenaScope& operator=(const FrameArenaScope&) = delete;
+};
+
+// Base for promise types. The compiler picks the allocator_arg overloads when the coroutine parameters match them.
+// Those are inlined so that GCC sees the frame come from the arena: an out-of-line template operator new paired with
+// the sized delete trips -Wmismatched-new-delete in every coroutine that uses them.
+struct ArenaFramePromise {
+    static void* operator new(std::size_t size) {
+      return CURRENT_FRAME_ARENA != nullptr ? Alloc_FrameArena(CURRENT_FRAME_ARENA, size) : Alloc_FramePool(size);
+    }
+    template <class... Args>
+    __attribute__((always_inline)) static void* operator new(std::size_t size, std::allocator_arg_t, VirtualArena* arena, Args&...) {
+      return Alloc_FrameArena(arena, size);
+    }
+    template <class This, class... Args>
+    __attribute__((always_inline)) static void* operator new(std::size_t size, This&, std::allocator_arg_t, VirtualArena* arena, Args&...) {
+      return Alloc_FrameArena(arena, size);
+    }
+    static void operator delete(void* frame, std::size_t size) { Free_Frame(frame, size); }
+    // Placement forms matching the allocator_arg overloads. The coroutine always frees through the sized form, the
+    // size is only needed to pop arena frames, so these leave them to the arena's next pop.
+    template <class... Args>
+    static void operator delete(void* frame, std::allocator_arg_t, VirtualArena*, Args&...) {
+      Free_Frame(frame, 0);
+    }
+    template <class This, class... Args>
+    static void operator delete(void* frame, This&, std::allocator_arg_t, VirtualArena*, Args&...) {
+      Free_Frame(frame, 0);
+    }
+};
+
+#endif
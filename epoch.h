@@ -0,0 +1,282 @@
+#ifndef _EPOCH_ABERLLOC_HEADER
+#define _EPOCH_ABERLLOC_HEADER
+#include <stdint.h>
+#include <stdlib.h>
+#include "./pressure.h"
+#include "./static_arena.h"
+#include "./utils.h"
+#include "./virtual_arena.h"
+#ifdef _WIN32
+#ifdef __GNUC__
+#include <windows.h>
+// Compilation using msys2 env or similar
+#else
+#error "You need to compile with gcc."
+#endif
+#else
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+// Epoch based reclamation of whole arenas. Writers build a new structure in a fresh arena, publish it, and retire the
+// old arena here. Readers wrap every traversal in Enter/Exit, which are a load and a store on the reader's own cache
+// line, no locks or reference counts. A retired arena (with its large blocks) is destroyed, or cleared and kept for
+// reuse, once every reader that could have seen it has left its read section.
+// Readers: thread-safe and wait-free. Writers (Retire, Reclaim, Acquire): thread-safe, serialised by a spinlock.
+
+#define EPOCH_MAX_READERS 128
+#define EPOCH_MAX_RETIRED 256
+#define EPOCH_MAX_RECYCLED 16
+
+typedef struct EpochReader {
+    uint64_t epoch_;   // Global epoch seen on enter, 0 outside a read section
+    int      in_use_;  // Registered
+} EpochReader;
+
+typedef struct RetiredArena {
+    uint64_t epoch_;  // Global epoch when retired
+    int      is_virtual_;
+    union {
+        VirtualArena virtual_;
+        StaticArena  static_;
+    } arena_;
+} RetiredArena;
+
+typedef struct EpochManager {
+    uint8_t*     memory_;   // Global epoch on the first cache line, one line per reader after it
+    uint64_t*    epoch_;    // Global epoch, starts at 1
+    size_t       total_size_;
+    int          lock_;
+    RetiredArena retired_[EPOCH_MAX_RETIRED];
+    size_t       retired_count_;
+    VirtualArena recycled_[EPOCH_MAX_RECYCLED];
+    size_t       recycled_count_;
+    size_t       recycle_limit_;  // Recycled arenas kept, 0 destroys everything
+} EpochManager;
+
+static inline EpochReader* Reader_EpochManager(EpochManager* manager, int reader) {
+  return (EpochReader*)(manager->memory_ + (size_t)(reader + 1) * CACHE_LINE_SIZE);
+}
+
+static void yield_thread_(void) {
+#ifdef _WIN32
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+static void Lock_EpochManager(EpochManager* manager) {
+  while (__atomic_exchange_n(&manager->lock_, 1, __ATOMIC_ACQUIRE)) {
+    yield_thread_();
+  }
+}
+static void Unlock_EpochManager(EpochManager* manager) {
+  __atomic_store_n(&manager->lock_, 0, __ATOMIC_RELEASE);
+}
+
+int Init_EpochManager(EpochManager* manager, size_t recycle_limit) {
+#ifdef DEBUG
+  if (manager == NULL || recycle_limit > EPOCH_MAX_RECYCLED) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  // Page aligned, so every reader slot sits alone on its cache line
+  manager->total_size_ = align_2pow((size_t)(EPOCH_MAX_READERS + 1) * CACHE_LINE_SIZE, _getPageSize());
+  manager->memory_     = os_new_virtual_mapping_commit(manager->total_size_);
+  if (manager->memory_ == NULL) {
+    return ERROR_OS_MEMORY;
+  }
+  memset(manager->memory_, 0, manager->total_size_);
+  manager->epoch_          = (uint64_t*)manager->memory_;
+  *manager->epoch_         = 1;
+  manager->lock_           = 0;
+  manager->retired_count_  = 0;
+  manager->recycled_count_ = 0;
+  manager->recycle_limit_  = recycle_limit;
+  return SUCCESS;
+}
+
+// Returns the reader slot to pass to Enter/Exit, or ERROR_OS_MEMORY when all EPOCH_MAX_READERS are taken
+int Register_EpochManager(EpochManager* manager) {
+  for (int reader = 0; reader < EPOCH_MAX_READERS; reader++) {
+    int free = 0;
+    if (__atomic_compare_exchange_n(&Reader_EpochManager(manager, reader)->in_use_, &free, 1, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      return reader;
+    }
+  }
+  return ERROR_OS_MEMORY;
+}
+int Unregister_EpochManager(EpochManager* manager, int reader) {
+#ifdef DEBUG
+  if (manager == NULL || reader < 0 || reader >= EPOCH_MAX_READERS) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  EpochReader* slot = Reader_EpochManager(manager, reader);
+  __atomic_store_n(&slot->epoch_, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&slot->in_use_, 0, __ATOMIC_RELEASE);
+  return SUCCESS;
+}
+
+// The fence orders the store before the (possibly plain) loads of the shared structure, a seq_cst store alone does
+// not. It pairs with the fence in Reclaim: either the writer sees this reader, or the reader sees the newly published
+// structure.
+static inline void Enter_EpochManager(EpochManager* manager, int reader) {
+  uint64_t epoch = __atomic_load_n(manager->epoch_, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&Reader_EpochManager(manager, reader)->epoch_, epoch, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+static inline void Exit_EpochManager(EpochManager* manager, int reader) {
+  __atomic_store_n(&Reader_EpochManager(manager, reader)->epoch_, 0, __ATOMIC_RELEASE);
+}
+
+static void Release_RetiredArena(EpochManager* manager, RetiredArena* retired) {
+  if (!retired->is_virtual_) {
+    Destroy_StaticArena(&retired->arena_.static_);
+    return;
+  }
+  // Under memory pressure nothing is kept for reuse
+  if (manager->recycled_count_ < manager->recycle_limit_ && PRESSURE_LEVEL() == PRESSURE_NONE) {
+    Clear_VirtualArena(&retired->arena_.virtual_);
+    manager->recycled_[manager->recycled_count_++] = retired->arena_.virtual_;
+    return;
+  }
+  Destroy_VirtualArena(&retired->arena_.virtual_);
+}
+
+// Advances the global epoch and releases every retired arena no reader can still be in.
+// Returns the number of arenas still waiting.
+static size_t ReclaimLocked_EpochManager(EpochManager* manager) {
+  __atomic_fetch_add(manager->epoch_, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  uint64_t oldest = UINT64_MAX;
+  for (int reader = 0; reader < EPOCH_MAX_READERS; reader++) {
+    uint64_t epoch = __atomic_load_n(&Reader_EpochManager(manager, reader)->epoch_, __ATOMIC_SEQ_CST);
+    if (epoch != 0 && epoch < oldest) {
+      oldest = epoch;
+    }
+  }
+  // A reader that entered at the retire epoch may hold the old pointer, one that entered later cannot
+  size_t kept = 0;
+  for (size_t i = 0; i < manager->retired_count_; i++) {
+    if (manager->retired_[i].epoch_ < oldest) {
+      Release_RetiredArena(manager, &manager->retired_[i]);
+    } else {
+      manager->retired_[kept++] = manager->retired_[i];
+    }
+  }
+  manager->retired_count_ = kept;
+  if (PRESSURE_LEVEL() == PRESSURE_CRITICAL) {
+    while (manager->recycled_count_ > 0) {
+      Destroy_VirtualArena(&manager->recycled_[--manager->recycled_count_]);
+    }
+  }
+  return kept;
+}
+size_t Reclaim_EpochManager(EpochManager* manager) {
+  Lock_EpochManager(manager);
+  size_t kept = ReclaimLocked_EpochManager(manager);
+  Unlock_EpochManager(manager);
+  return kept;
+}
+
+// Takes ownership of the arena, which must already be unreachable for readers entering from now on. The arena
+// struct is copied, the caller's one can be reused right away. Waits for readers only when the retire list is full.
+static void Retire_EpochManager(EpochManager* manager, RetiredArena* retired) {
+  Lock_EpochManager(manager);
+  while (manager->retired_count_ == EPOCH_MAX_RETIRED && ReclaimLocked_EpochManager(manager) == EPOCH_MAX_RETIRED) {
+    yield_thread_();
+  }
+  retired->epoch_                            = __atomic_load_n(manager->epoch_, __ATOMIC_SEQ_CST);
+  manager->retired_[manager->retired_count_++] = *retired;
+  Unlock_EpochManager(manager);
+}
+int RetireVirtual_EpochManager(EpochManager* manager, VirtualArena* arena) {
+#ifdef DEBUG
+  if (manager == NULL || arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  RetiredArena retired;
+  retired.is_virtual_     = TRUE;
+  retired.arena_.virtual_ = *arena;
+  Retire_EpochManager(manager, &retired);
+  arena->memory_ = NULL;
+  arena->blocks_ = NULL;
+  return SUCCESS;
+}
+int RetireStatic_EpochManager(EpochManager* manager, StaticArena* arena) {
+#ifdef DEBUG
+  if (manager == NULL || arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  RetiredArena retired;
+  retired.is_virtual_    = FALSE;
+  retired.arena_.static_ = *arena;
+  Retire_EpochManager(manager, &retired);
+  arena->memory_      = NULL;
+  arena->blocks_      = NULL;
+  arena->blocks_tail_ = NULL;
+  return SUCCESS;
+}
+
+// Hands out a recycled arena reserving at least arena_size, or initialises a new one when none fits.
+// Recycled arenas come back cleared, with their policy and alignment, and whatever commit the policy kept.
+int Acquire_EpochManager(EpochManager* manager, VirtualArena* arena, size_t arena_size, size_t auto_align, int remapping) {
+#ifdef DEBUG
+  if (manager == NULL || arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  Lock_EpochManager(manager);
+  for (size_t i = 0; i < manager->recycled_count_; i++) {
+    if (manager->recycled_[i].total_size_ >= arena_size && manager->recycled_[i].remapping == remapping) {
+      *arena                 = manager->recycled_[i];
+      manager->recycled_[i] = manager->recycled_[--manager->recycled_count_];
+      Unlock_EpochManager(manager);
+      // Same rule as Init_VirtualArena
+      if (auto_align > WORD_SIZE && __builtin_popcountll(auto_align) == 1) {
+        return SetAutoAlign2Pow_VirtualArena(arena, auto_align);
+      }
+      arena->auto_align_ = FALSE;
+      arena->alignment_  = WORD_SIZE;
+      return SUCCESS;
+    }
+  }
+  Unlock_EpochManager(manager);
+  return Init_VirtualArena(arena, arena_size, auto_align, remapping);
+}
+
+// Drops the recycled arenas, for memory pressure or shutdown. Thread-safe, fits a pressure callback.
+int Trim_EpochManager(EpochManager* manager) {
+  Lock_EpochManager(manager);
+  while (manager->recycled_count_ > 0) {
+    Destroy_VirtualArena(&manager->recycled_[--manager->recycled_count_]);
+  }
+  Unlock_EpochManager(manager);
+  return SUCCESS;
+}
+
+// No reader may be inside a read section anymore, everything retired is destroyed
+int Destroy_EpochManager(EpochManager* manager) {
+#ifdef DEBUG
+  if (manager == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  manager->recycle_limit_ = 0;
+  for (size_t i = 0; i < manager->retired_count_; i++) {
+    Release_RetiredArena(manager, &manager->retired_[i]);
+  }
+  manager->retired_count_ = 0;
+  Trim_EpochManager(manager);
+  if (os_free_(manager->memory_, manager->total_size_) == ERROR_OS_MEMORY) {
+    DEBUG_PRINT("Freeing the reader slots did not work. Memory leaked.");
+  }
+  manager->memory_ = NULL;
+  manager->epoch_  = NULL;
+  return SUCCESS;
+}
+
+#endif
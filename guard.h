@@ -0,0 +1,301 @@
+#ifndef _GUARD_ABERLLOC_HEADER
+#define _GUARD_ABERLLOC_HEADER
+#include <stdint.h>
+#include <stdlib.h>
+#include "./utils.h"
+// Sampling guard pages for production builds, compiled in with ABERLLOC_GUARD_SAMPLING. About one push in
+// ABERLLOC_GUARD_RATE is served from a slot of its own, between two inaccessible pages and right-aligned so that
+// overflows fault on the next guard page. The arena still reserves the bytes at its own top, so positions and pops
+// behave exactly as without sampling. Popping or clearing the arena below the push makes the slot inaccessible, and
+// any later access faults and is reported on stderr before the process dies as it normally would.
+// The cost for pushes that are not sampled is a thread-local decrement, for pops a load while no slot is live.
+// Allocations larger than a slot are never sampled.
+// Thread-safe, the slot table is shared by all arenas of the process.
+
+#ifdef ABERLLOC_GUARD_SAMPLING
+#ifdef _WIN32
+#error "Guard sampling reports faults through POSIX signals"
+#endif
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef ABERLLOC_GUARD_RATE
+#define ABERLLOC_GUARD_RATE 4096  // Mean pushes between two samples
+#endif
+#ifndef ABERLLOC_GUARD_SLOTS
+#define ABERLLOC_GUARD_SLOTS 256
+#endif
+#ifndef ABERLLOC_GUARD_SLOT_PAGES
+#define ABERLLOC_GUARD_SLOT_PAGES 1
+#endif
+
+#define GUARD_STATE_FREE      0
+#define GUARD_STATE_LIVE      1
+#define GUARD_STATE_PROTECTED 2
+
+typedef struct GuardedSlot {
+    const void* arena_;
+    uint64_t    position_;  // Arena position the push started at
+    uint8_t*    original_;  // Arena memory reserved by the push, returned to PopToAdress
+    uint8_t*    memory_;    // What the caller got, inside the slot
+    size_t      bytes_;
+    uint64_t    protected_at_;  // Protection order, the oldest protected slot is reused first
+    int         state_;
+} GuardedSlot;
+
+typedef struct GuardPool {
+    uint8_t*         memory_;  // Guard page, slot, guard page, slot, ..., guard page
+    size_t           total_size_;
+    size_t           slot_size_;
+    size_t           stride_;  // Slot plus the guard page before it
+    GuardedSlot      slots_[ABERLLOC_GUARD_SLOTS];
+    size_t           live_;
+    uint64_t         protect_count_;
+    int              lock_;
+    int              failed_;
+    struct sigaction previous_;
+} GuardPool;
+
+static GuardPool         GUARD_POOL;
+static __thread uint64_t GUARD_COUNTDOWN = ABERLLOC_GUARD_RATE;
+static __thread uint64_t GUARD_RANDOM    = 0;
+static __thread int      GUARD_SUSPENDED = 0;
+
+static void Lock_GuardPool(void) {
+  while (__atomic_exchange_n(&GUARD_POOL.lock_, 1, __ATOMIC_ACQUIRE)) {
+  }
+}
+static void Unlock_GuardPool(void) {
+  __atomic_store_n(&GUARD_POOL.lock_, 0, __ATOMIC_RELEASE);
+}
+
+// Async-signal-safe formatting for the report
+static size_t append_text_(char* buffer, size_t length, const char* text) {
+  while (*text != '\0' && length < 511) {
+    buffer[length++] = *text++;
+  }
+  return length;
+}
+static size_t append_number_(char* buffer, size_t length, uint64_t value, int base) {
+  char   digits[24];
+  size_t count = 0;
+  do {
+    digits[count++] = "0123456789abcdef"[value % base];
+    value /= base;
+  } while (value != 0);
+  if (base == 16) {
+    length = append_text_(buffer, length, "0x");
+  }
+  while (count > 0 && length < 511) {
+    buffer[length++] = digits[--count];
+  }
+  return length;
+}
+
+static void Handler_GuardPool(int signal_number, siginfo_t* info, void* context) {
+  (void)signal_number;
+  (void)context;
+  uint8_t* address = (uint8_t*)info->si_addr;
+  if (GUARD_POOL.memory_ != NULL && address >= GUARD_POOL.memory_ && address < GUARD_POOL.memory_ + GUARD_POOL.total_size_) {
+    size_t       offset = address - GUARD_POOL.memory_;
+    size_t       index  = offset / GUARD_POOL.stride_;
+    int          guard  = offset % GUARD_POOL.stride_ < GUARD_POOL.stride_ - GUARD_POOL.slot_size_;
+    char         report[512];
+    size_t       length = 0;
+    GuardedSlot* slot;
+    if (guard && index > 0) {
+      // Slots are right-aligned, a guard page is hit by the slot before it
+      slot   = &GUARD_POOL.slots_[index - 1];
+      length = append_text_(report, length, "aberlloc: overflow past a sampled push of ");
+    } else if (guard || index >= ABERLLOC_GUARD_SLOTS) {
+      slot   = &GUARD_POOL.slots_[index < ABERLLOC_GUARD_SLOTS ? index : ABERLLOC_GUARD_SLOTS - 1];
+      length = append_text_(report, length, "aberlloc: underflow before a sampled push of ");
+    } else {
+      slot   = &GUARD_POOL.slots_[index];
+      length = append_text_(report, length,
+                            slot->state_ == GUARD_STATE_PROTECTED ? "aberlloc: use after pop of a sampled push of "
+                                                                  : "aberlloc: access before the start of a sampled push of ");
+    }
+    length = append_number_(report, length, slot->bytes_, 10);
+    length = append_text_(report, length, " bytes at ");
+    length = append_number_(report, length, (uintptr_t)slot->memory_, 16);
+    length = append_text_(report, length, ", fault at ");
+    length = append_number_(report, length, (uintptr_t)address, 16);
+    length = append_text_(report, length, ", arena ");
+    length = append_number_(report, length, (uintptr_t)slot->arena_, 16);
+    length = append_text_(report, length, " position ");
+    length = append_number_(report, length, slot->position_, 10);
+    length = append_text_(report, length, "\n");
+    if (write(STDERR_FILENO, report, length) < 0) {
+    }
+  }
+  // Back to the previous handler, the faulting access runs again and reaches it
+  sigaction(SIGSEGV, &GUARD_POOL.previous_, NULL);
+}
+
+// Lazily maps the pool on the first sample, everything starts inaccessible
+static int Init_GuardPool(void) {
+  if (GUARD_POOL.memory_ != NULL) {
+    return SUCCESS;
+  }
+  if (GUARD_POOL.failed_) {
+    return ERROR_OS_MEMORY;
+  }
+  GUARD_POOL.slot_size_  = (size_t)ABERLLOC_GUARD_SLOT_PAGES * _getPageSize();
+  GUARD_POOL.stride_     = GUARD_POOL.slot_size_ + _getPageSize();
+  GUARD_POOL.total_size_ = GUARD_POOL.stride_ * ABERLLOC_GUARD_SLOTS + _getPageSize();
+  uint8_t* memory        = os_new_virtual_mapping_(GUARD_POOL.total_size_);
+  if (memory == NULL || os_protect_none(memory, GUARD_POOL.total_size_) != SUCCESS) {
+    GUARD_POOL.failed_ = TRUE;
+    return ERROR_OS_MEMORY;
+  }
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = Handler_GuardPool;
+  action.sa_flags     = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &GUARD_POOL.previous_);
+  GUARD_POOL.memory_ = memory;
+  return SUCCESS;
+}
+
+// Next countdown, uniform in [1, 2 * rate] so samples are not periodic
+static uint64_t Next_GuardCountdown(void) {
+  if (GUARD_RANDOM == 0) {
+    GUARD_RANDOM = ((uintptr_t)&GUARD_RANDOM ^ (uint64_t)getpid() << 32) | 1;
+  }
+  GUARD_RANDOM ^= GUARD_RANDOM << 13;
+  GUARD_RANDOM ^= GUARD_RANDOM >> 7;
+  GUARD_RANDOM ^= GUARD_RANDOM << 17;
+  return 1 + GUARD_RANDOM % (2 * ABERLLOC_GUARD_RATE);
+}
+
+static void Protect_GuardedSlot(GuardedSlot* slot, size_t index) {
+  uint8_t* memory = GUARD_POOL.memory_ + index * GUARD_POOL.stride_ + _getPageSize();
+  os_protect_none(memory, GUARD_POOL.slot_size_);
+  // Drops the pages, a reused slot starts zeroed
+  os_uncommit_(memory, GUARD_POOL.slot_size_);
+  slot->state_        = GUARD_STATE_PROTECTED;
+  slot->protected_at_ = ++GUARD_POOL.protect_count_;
+  GUARD_POOL.live_--;
+}
+
+// Serves a sampled push from a slot, or returns the arena memory when the push is too large or no slot is free.
+// Free slots go first, then the one protected the longest ago, live slots are never taken.
+static uint8_t* Take_GuardedSlot(const void* arena, uint64_t position, uint8_t* original, size_t bytes, size_t alignment) {
+  GUARD_COUNTDOWN = Next_GuardCountdown();
+  if (GUARD_SUSPENDED || original == NULL) {
+    return original;
+  }
+  Lock_GuardPool();
+  if (Init_GuardPool() != SUCCESS || bytes > GUARD_POOL.slot_size_ || alignment > GUARD_POOL.slot_size_) {
+    Unlock_GuardPool();
+    return original;
+  }
+  size_t chosen = ABERLLOC_GUARD_SLOTS;
+  for (size_t i = 0; i < ABERLLOC_GUARD_SLOTS; i++) {
+    GuardedSlot* slot = &GUARD_POOL.slots_[i];
+    if (slot->state_ == GUARD_STATE_FREE) {
+      chosen = i;
+      break;
+    }
+    if (slot->state_ == GUARD_STATE_PROTECTED &&
+        (chosen == ABERLLOC_GUARD_SLOTS || slot->protected_at_ < GUARD_POOL.slots_[chosen].protected_at_)) {
+      chosen = i;
+    }
+  }
+  if (chosen == ABERLLOC_GUARD_SLOTS) {
+    Unlock_GuardPool();
+    return original;
+  }
+  GuardedSlot* slot   = &GUARD_POOL.slots_[chosen];
+  uint8_t*     memory = GUARD_POOL.memory_ + chosen * GUARD_POOL.stride_ + _getPageSize();
+  if (os_protect_readwrite(memory, GUARD_POOL.slot_size_) != SUCCESS) {
+    Unlock_GuardPool();
+    return original;
+  }
+  slot->arena_    = arena;
+  slot->position_ = position;
+  slot->original_ = original;
+  slot->memory_   = (uint8_t*)(((uintptr_t)memory + GUARD_POOL.slot_size_ - bytes) & ~(uintptr_t)(alignment - 1));
+  slot->bytes_    = bytes;
+  slot->state_    = GUARD_STATE_LIVE;
+  GUARD_POOL.live_++;
+  Unlock_GuardPool();
+  return slot->memory_;
+}
+
+// Protects the live slots of the arena pushed at or above position
+static void Pop_GuardedSlots(const void* arena, uint64_t position) {
+  Lock_GuardPool();
+  for (size_t i = 0; i < ABERLLOC_GUARD_SLOTS && GUARD_POOL.live_ > 0; i++) {
+    GuardedSlot* slot = &GUARD_POOL.slots_[i];
+    if (slot->state_ == GUARD_STATE_LIVE && slot->arena_ == arena && slot->position_ >= position) {
+      Protect_GuardedSlot(slot, i);
+    }
+  }
+  Unlock_GuardPool();
+}
+
+// Hands the live slots of a scratch space over to its parent, base_position is where the scratch starts in the parent
+static void Merge_GuardedSlots(const void* scratch, const void* parent, uint64_t base_position) {
+  Lock_GuardPool();
+  for (size_t i = 0; i < ABERLLOC_GUARD_SLOTS; i++) {
+    GuardedSlot* slot = &GUARD_POOL.slots_[i];
+    if (slot->state_ == GUARD_STATE_LIVE && slot->arena_ == scratch) {
+      slot->arena_ = parent;
+      slot->position_ += base_position;
+    }
+  }
+  Unlock_GuardPool();
+}
+
+// Maps a pointer handed out from a slot back to the arena memory it stands for
+static uint8_t* Address_GuardedSlot(const void* arena, uint8_t* address) {
+  if (GUARD_POOL.memory_ == NULL || address < GUARD_POOL.memory_ || address >= GUARD_POOL.memory_ + GUARD_POOL.total_size_) {
+    return address;
+  }
+  Lock_GuardPool();
+  size_t       index  = (address - GUARD_POOL.memory_) / GUARD_POOL.stride_;
+  GuardedSlot* slot   = &GUARD_POOL.slots_[index < ABERLLOC_GUARD_SLOTS ? index : ABERLLOC_GUARD_SLOTS - 1];
+  uint8_t*     mapped = address;
+  if (slot->state_ == GUARD_STATE_LIVE && slot->arena_ == arena && address >= slot->memory_) {
+    mapped = slot->original_ + (address - slot->memory_);
+  }
+  Unlock_GuardPool();
+  return mapped;
+}
+
+#define GUARD_SAMPLE(arena, position, memory, bytes, alignment)                                     \
+  do {                                                                                              \
+    if (--GUARD_COUNTDOWN == 0) {                                                                   \
+      (memory) = Take_GuardedSlot((arena), (position), (memory), (bytes), (alignment));             \
+    }                                                                                               \
+  } while (0)
+#define GUARD_POP(arena, position)                                \
+  do {                                                            \
+    if (__atomic_load_n(&GUARD_POOL.live_, __ATOMIC_RELAXED)) {   \
+      Pop_GuardedSlots((arena), (position));                      \
+    }                                                             \
+  } while (0)
+#define GUARD_MERGE(scratch, parent, base_position)                     \
+  do {                                                                  \
+    if (__atomic_load_n(&GUARD_POOL.live_, __ATOMIC_RELAXED)) {         \
+      Merge_GuardedSlots((scratch), (parent), (base_position));         \
+    }                                                                   \
+  } while (0)
+#define GUARD_ADDRESS(arena, address) Address_GuardedSlot((arena), (address))
+// Around pushes whose caller derives offsets from the returned pointer (scratch spaces, handles, layouts)
+#define GUARD_SUSPEND()               (GUARD_SUSPENDED++)
+#define GUARD_RESUME()                (GUARD_SUSPENDED--)
+#else
+#define GUARD_SAMPLE(arena, position, memory, bytes, alignment) ((void)0)
+#define GUARD_POP(arena, position)                              ((void)0)
+#define GUARD_MERGE(scratch, parent, base_position)             ((void)0)
+#define GUARD_ADDRESS(arena, address)                           (address)
+#define GUARD_SUSPEND()                                         ((void)0)
+#define GUARD_RESUME()                                          ((void)0)
+#endif
+
+#endif
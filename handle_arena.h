@@ -0,0 +1,247 @@
+#ifndef _HANDLE_ARENA_HEADER
+#define _HANDLE_ARENA_HEADER
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./utils.h"
+#include "./virtual_arena.h"
+// Relocatable allocations on top of a remapping virtual arena. Users keep 32-bit handles instead of pointers, so the
+// arena is free to remap or slide allocations down (compaction) and return the freed tail to the OS.
+// A handle is [generation (8 bits) | entry index (24 bits)], stale handles resolve to NULL.
+// Pointers returned by Get_HandleArena are only valid until the next Alloc or Compact call.
+// Single-threaded
+#define HANDLE_NULL          0
+#define HANDLE_INDEX_BITS    24
+#define HANDLE_INDEX_MASK    ((1u << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_MAX_ENTRIES   HANDLE_INDEX_MASK
+#define HANDLE_LIST_END      HANDLE_INDEX_MASK
+
+typedef uint32_t ArenaHandle;
+
+typedef struct HandleEntry {
+    uintptr_t offset_;
+    uintptr_t size_;
+    uint32_t  generation_;  // Never 0, so that no valid handle is HANDLE_NULL
+    uint32_t  live_;
+    uint32_t  prev_;  // Live entries are linked in offset order
+    uint32_t  next_;  // Also links the free entries
+} HandleEntry;
+
+typedef struct HandleArena {
+    VirtualArena arena_;  // Data
+    VirtualArena table_;  // Entries, kept apart from the data so compaction never touches them
+    uint32_t     entry_count_;
+    uint32_t     max_entries_;
+    uint32_t     free_head_;
+    uint32_t     first_live_;  // Lowest offset
+    uint32_t     last_live_;   // Highest offset, ends at the top of the arena
+    uintptr_t    live_bytes_;
+} HandleArena;
+
+static inline HandleEntry* Entry_HandleArena(HandleArena* handle_arena, uint32_t index) {
+  return (HandleEntry*)handle_arena->table_.memory_ + index;
+}
+
+static HandleEntry* Lookup_HandleArena(HandleArena* handle_arena, ArenaHandle handle) {
+  uint32_t index = handle & HANDLE_INDEX_MASK;
+  if (index >= handle_arena->entry_count_) {
+    return NULL;
+  }
+  HandleEntry* entry = Entry_HandleArena(handle_arena, index);
+  if (!entry->live_ || entry->generation_ != (handle >> HANDLE_INDEX_BITS)) {
+    return NULL;
+  }
+  return entry;
+}
+
+static uint32_t NewEntry_HandleArena(HandleArena* handle_arena) {
+  // Returns HANDLE_LIST_END if the table is full
+  if (handle_arena->free_head_ != HANDLE_LIST_END) {
+    uint32_t index          = handle_arena->free_head_;
+    handle_arena->free_head_ = Entry_HandleArena(handle_arena, index)->next_;
+    return index;
+  }
+  if (handle_arena->entry_count_ == handle_arena->max_entries_) {
+    return HANDLE_LIST_END;
+  }
+  uintptr_t needed = (uintptr_t)(handle_arena->entry_count_ + 1) * sizeof(HandleEntry);
+  while (needed > handle_arena->table_.committed_size_) {
+    if (ExtendCommit_VirtualArena(&handle_arena->table_, extendPolicy(handle_arena->table_.committed_size_)) == ERROR_OS_MEMORY) {
+      return HANDLE_LIST_END;
+    }
+  }
+  handle_arena->table_.position_ = needed;
+  HandleEntry* entry             = Entry_HandleArena(handle_arena, handle_arena->entry_count_);
+  entry->generation_             = 1;
+  entry->live_                   = FALSE;
+  return handle_arena->entry_count_++;
+}
+
+int Init_HandleArena(HandleArena* handle_arena, size_t arena_size, int max_entries, size_t auto_align) {
+#ifdef DEBUG
+  if (handle_arena == NULL || max_entries <= 0 || max_entries > HANDLE_MAX_ENTRIES) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  // The data arena always remaps, handles do not care where the base is
+  if (Init_VirtualArena(&handle_arena->arena_, arena_size, auto_align, TRUE) != SUCCESS) {
+    return ERROR_OS_MEMORY;
+  }
+  size_t table_size = align_2pow((size_t)max_entries * sizeof(HandleEntry), _getPageSize());
+  if (Init_VirtualArena(&handle_arena->table_, table_size, 0, FALSE) != SUCCESS) {
+    Destroy_VirtualArena(&handle_arena->arena_);
+    return ERROR_OS_MEMORY;
+  }
+  handle_arena->entry_count_ = 0;
+  handle_arena->max_entries_ = max_entries;
+  handle_arena->free_head_   = HANDLE_LIST_END;
+  handle_arena->first_live_  = HANDLE_LIST_END;
+  handle_arena->last_live_   = HANDLE_LIST_END;
+  handle_arena->live_bytes_  = 0;
+  return SUCCESS;
+}
+
+int Destroy_HandleArena(HandleArena* handle_arena) {
+#ifdef DEBUG
+  if (handle_arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  Destroy_VirtualArena(&handle_arena->arena_);
+  Destroy_VirtualArena(&handle_arena->table_);
+  handle_arena->entry_count_ = 0;
+  handle_arena->max_entries_ = 0;
+  handle_arena->free_head_   = HANDLE_LIST_END;
+  handle_arena->first_live_  = HANDLE_LIST_END;
+  handle_arena->last_live_   = HANDLE_LIST_END;
+  handle_arena->live_bytes_  = 0;
+  return SUCCESS;
+}
+
+ArenaHandle Alloc_HandleArena(HandleArena* handle_arena, size_t bytes) {
+  // HANDLE_NULL on failure
+#ifdef DEBUG
+  if (handle_arena == NULL) {
+    return HANDLE_NULL;
+  }
+#endif
+  uint32_t index = NewEntry_HandleArena(handle_arena);
+  if (index == HANDLE_LIST_END) {
+    DEBUG_PRINT("Handle table is full");
+    return HANDLE_NULL;
+  }
+  HandleEntry* entry = Entry_HandleArena(handle_arena, index);
+  // Offsets are taken from the returned pointer, a sampled push would not be inside the arena
+  GUARD_SUSPEND();
+  uint8_t* mem = Push_VirtualArena(&handle_arena->arena_, bytes);
+  GUARD_RESUME();
+  if (mem == NULL) {
+    entry->next_             = handle_arena->free_head_;
+    handle_arena->free_head_ = index;
+    return HANDLE_NULL;
+  }
+  entry->offset_ = mem - handle_arena->arena_.memory_;
+  entry->size_   = bytes;
+  entry->live_   = TRUE;
+  // New allocations are always at the top
+  entry->prev_ = handle_arena->last_live_;
+  entry->next_ = HANDLE_LIST_END;
+  if (handle_arena->last_live_ != HANDLE_LIST_END) {
+    Entry_HandleArena(handle_arena, handle_arena->last_live_)->next_ = index;
+  } else {
+    handle_arena->first_live_ = index;
+  }
+  handle_arena->last_live_ = index;
+  handle_arena->live_bytes_ += bytes;
+  return (entry->generation_ << HANDLE_INDEX_BITS) | index;
+}
+
+uint8_t* Get_HandleArena(HandleArena* handle_arena, ArenaHandle handle) {
+  // NULL if the handle is stale
+  HandleEntry* entry = Lookup_HandleArena(handle_arena, handle);
+  if (entry == NULL) {
+    return NULL;
+  }
+  return handle_arena->arena_.memory_ + entry->offset_;
+}
+
+int Free_HandleArena(HandleArena* handle_arena, ArenaHandle handle) {
+  HandleEntry* entry = Lookup_HandleArena(handle_arena, handle);
+  if (entry == NULL) {
+    DEBUG_PRINT("Freeing a stale handle");
+    return ERROR_INVALID_PARAMS;
+  }
+  uint32_t index = handle & HANDLE_INDEX_MASK;
+  if (entry->prev_ != HANDLE_LIST_END) {
+    Entry_HandleArena(handle_arena, entry->prev_)->next_ = entry->next_;
+  } else {
+    handle_arena->first_live_ = entry->next_;
+  }
+  if (entry->next_ != HANDLE_LIST_END) {
+    Entry_HandleArena(handle_arena, entry->next_)->prev_ = entry->prev_;
+  } else {
+    // Freeing the top allocation gives the memory back right away
+    handle_arena->last_live_ = entry->prev_;
+    uintptr_t top            = 0;
+    if (entry->prev_ != HANDLE_LIST_END) {
+      HandleEntry* prev = Entry_HandleArena(handle_arena, entry->prev_);
+      top               = prev->offset_ + prev->size_;
+    }
+    PopTo_VirtualArena(&handle_arena->arena_, top);
+  }
+  handle_arena->live_bytes_ -= entry->size_;
+  entry->live_   = FALSE;
+  entry->offset_ = 0;
+  entry->size_   = 0;
+  // Generations cycle through 1..255
+  entry->generation_ = entry->generation_ % 255 + 1;
+  entry->next_             = handle_arena->free_head_;
+  handle_arena->free_head_ = index;
+  return SUCCESS;
+}
+
+int Compact_HandleArena(HandleArena* handle_arena) {
+  // Slides every live allocation down in offset order, then decommits everything above the new top.
+#ifdef DEBUG
+  if (handle_arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  VirtualArena* arena = &handle_arena->arena_;
+  uintptr_t     top   = arena->color_;
+  uint32_t      index = handle_arena->first_live_;
+  while (index != HANDLE_LIST_END) {
+    HandleEntry* entry = Entry_HandleArena(handle_arena, index);
+    // Same alignment as the push, which started at or above top, so the entry never moves up
+    if (arena->auto_align_) {
+      top = align_2pow(top, arena->alignment_);
+    }
+#ifdef DEBUG
+    if (top > entry->offset_) {
+      DEBUG_PRINT("Compaction would move an allocation up");
+      return ERROR_INVALID_PARAMS;
+    }
+#endif
+    if (top != entry->offset_) {
+      // Destination is below the source, overlap is fine with memmove
+      memmove(arena->memory_ + top, arena->memory_ + entry->offset_, entry->size_);
+      entry->offset_ = top;
+    }
+    top += entry->size_;
+    index = entry->next_;
+  }
+  PopTo_VirtualArena(arena, top);
+  uintptr_t keep = align_2pow(top, _getPageSize());
+  if (keep < _getPageSize()) {
+    keep = _getPageSize();
+  }
+  if (keep < arena->committed_size_) {
+    if (ReduceCommit_VirtualArena(arena, keep) == ERROR_OS_MEMORY) {
+      DEBUG_PRINT("Reduce commit after compaction failed");
+      return ERROR_OS_MEMORY;
+    }
+  }
+  return SUCCESS;
+}
+
+#endif
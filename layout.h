@@ -0,0 +1,195 @@
+#ifndef _LAYOUT_ABERLLOC_HEADER
+#define _LAYOUT_ABERLLOC_HEADER
+#include <stdint.h>
+#include <stdlib.h>
+#include "./chained_arena.h"
+#include "./static_arena.h"
+#include "./utils.h"
+#include "./virtual_arena.h"
+// Struct-of-arrays layouts. A batch of parallel arrays is described once, laid out back to back with every column
+// aligned, and pushed with a single call, so there is one bounds and commit check per batch instead of one per column.
+// Column i of the batch lands in columns_out[i]. Layout pushes are never served by guard sampling, the padding is
+// computed against the arena top, or for the worst case when the push cannot fit above it.
+
+#ifndef VECTOR_WIDTH
+#if defined(__AVX512F__)
+#define VECTOR_WIDTH 64
+#elif defined(__AVX__)
+#define VECTOR_WIDTH 32
+#else
+#define VECTOR_WIDTH 16  // SSE, NEON
+#endif
+#endif
+
+// Flags
+#define LAYOUT_PAD_VECTOR 1  // Round every column up to whole vectors, loops can run full vectors without a tail
+
+typedef struct ColumnDesc {
+    size_t element_size_;
+    size_t count_;
+    size_t alignment_;  // Power of two, 0 for a cache line (the detected size, see _getCacheLineSize)
+} ColumnDesc;
+
+// Walks the columns computing their offsets, writes base + offset to columns_out when given.
+// Returns TRUE on overflow.
+static int walk_layout_(const ColumnDesc* columns, size_t column_count, int flags, uint8_t* base, void** columns_out,
+                        size_t* size_out, size_t* alignment_out) {
+  size_t offset    = 0;
+  size_t line_size = _getCacheLineSize();
+  size_t alignment = line_size;
+  for (size_t i = 0; i < column_count; i++) {
+    size_t column_alignment = columns[i].alignment_ ? columns[i].alignment_ : line_size;
+    size_t bytes;
+    if (flags & LAYOUT_PAD_VECTOR && column_alignment < VECTOR_WIDTH) {
+      column_alignment = VECTOR_WIDTH;
+    }
+    if (align_2pow_overflow(offset, column_alignment, &offset) || size_mul_overflow(columns[i].element_size_, columns[i].count_, &bytes)) {
+      return TRUE;
+    }
+    if (flags & LAYOUT_PAD_VECTOR && align_2pow_overflow(bytes, VECTOR_WIDTH, &bytes)) {
+      return TRUE;
+    }
+    if (columns_out != NULL) {
+      columns_out[i] = base + offset;
+    }
+    if (size_add_overflow(offset, bytes, &offset)) {
+      return TRUE;
+    }
+    if (column_alignment > alignment) {
+      alignment = column_alignment;
+    }
+  }
+  *size_out      = offset;
+  *alignment_out = alignment;
+  return FALSE;
+}
+
+// Size and base alignment of a layout, for callers that manage the memory themselves
+int Compute_ArenaLayout(const ColumnDesc* columns, size_t column_count, int flags, size_t* size, size_t* alignment) {
+#ifdef DEBUG
+  if (columns == NULL || size == NULL || alignment == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+  for (size_t i = 0; i < column_count; i++) {
+    if (columns[i].alignment_ != 0 && __builtin_popcountll(columns[i].alignment_) != 1) {
+      return ERROR_INVALID_PARAMS;
+    }
+  }
+#endif
+  if (walk_layout_(columns, column_count, flags, NULL, NULL, size, alignment)) {
+    DEBUG_PRINT("Layout size overflows");
+    return ERROR_INVALID_PARAMS;
+  }
+  return SUCCESS;
+}
+
+// Bytes to push so that the layout can be placed at an aligned address. When the push fits in the room left above
+// the top, the padding is exact. Otherwise it falls back to a large block or a new chunk whose start alignment is
+// unknown (large blocks are right-aligned in their mapping), so the worst case is reserved. Alignments above a page
+// always take the worst case, remapping keeps the address modulo a page only.
+static int layout_push_size_(uintptr_t top, size_t room, size_t size, size_t alignment, size_t* bytes) {
+  if (alignment <= _getPageSize() && !size_add_overflow(size, align_2pow(top, alignment) - top, bytes) && *bytes <= room) {
+    return FALSE;
+  }
+  return size_add_overflow(size, alignment - 1, bytes);
+}
+static inline size_t layout_room_(uintptr_t position, uintptr_t total_size) {
+  return position < total_size ? total_size - position : 0;
+}
+
+// Validates the layout and sizes its push against the arena top as the push's own auto alignment leaves it, so a
+// failure leaves the arena untouched. Past a page the arenas differ on aligning the offset or the address, so the worst
+// case is taken. Returns TRUE when the layout cannot be pushed.
+static int plan_layout_(const ColumnDesc* columns, size_t column_count, int flags, uint8_t* memory, uintptr_t position,
+                        uintptr_t total_size, size_t auto_alignment, size_t* alignment, size_t* bytes) {
+  size_t size;
+  if (Compute_ArenaLayout(columns, column_count, flags, &size, alignment) != SUCCESS) {
+    return TRUE;
+  }
+  uintptr_t top  = align_2pow((uintptr_t)memory + position, auto_alignment);
+  size_t    room = auto_alignment > _getPageSize() ? 0 : layout_room_(top - (uintptr_t)memory, total_size);
+  return layout_push_size_(top, room, size, *alignment, bytes);
+}
+// Places the columns on the first aligned address of the pushed memory
+static uint8_t* place_layout_(uint8_t* mem, const ColumnDesc* columns, size_t column_count, int flags, size_t alignment,
+                              void** columns_out) {
+  size_t size;
+  if (mem == NULL) {
+    return NULL;
+  }
+  uint8_t* base = (uint8_t*)align_2pow((uintptr_t)mem, alignment);
+  walk_layout_(columns, column_count, flags, base, columns_out, &size, &alignment);
+  return base;
+}
+
+uint8_t* PushLayoutNoZero_StaticArena(StaticArena* arena, const ColumnDesc* columns, size_t column_count, int flags, void** columns_out) {
+  size_t alignment, bytes;
+  if (plan_layout_(columns, column_count, flags, arena->memory_, arena->position_, arena->total_size_,
+                   arena->auto_align_ ? arena->alignment_ : 1, &alignment, &bytes)) {
+    return NULL;
+  }
+  GUARD_SUSPEND();
+  uint8_t* mem = PushNoZero_StaticArena(arena, bytes);
+  GUARD_RESUME();
+  return place_layout_(mem, columns, column_count, flags, alignment, columns_out);
+}
+uint8_t* PushLayout_StaticArena(StaticArena* arena, const ColumnDesc* columns, size_t column_count, int flags, void** columns_out) {
+  size_t alignment, bytes;
+  if (plan_layout_(columns, column_count, flags, arena->memory_, arena->position_, arena->total_size_,
+                   arena->auto_align_ ? arena->alignment_ : 1, &alignment, &bytes)) {
+    return NULL;
+  }
+  GUARD_SUSPEND();
+  uint8_t* mem = Push_StaticArena(arena, bytes);
+  GUARD_RESUME();
+  return place_layout_(mem, columns, column_count, flags, alignment, columns_out);
+}
+
+uint8_t* PushLayoutNoZero_VirtualArena(VirtualArena* arena, const ColumnDesc* columns, size_t column_count, int flags, void** columns_out) {
+  size_t alignment, bytes;
+  if (plan_layout_(columns, column_count, flags, arena->memory_, arena->position_,
+                   arena->remapping ? SIZE_MAX : arena->total_size_, arena->auto_align_ ? arena->alignment_ : 1, &alignment, &bytes)) {
+    return NULL;
+  }
+  GUARD_SUSPEND();
+  uint8_t* mem = PushNoZero_VirtualArena(arena, bytes);
+  GUARD_RESUME();
+  return place_layout_(mem, columns, column_count, flags, alignment, columns_out);
+}
+uint8_t* PushLayout_VirtualArena(VirtualArena* arena, const ColumnDesc* columns, size_t column_count, int flags, void** columns_out) {
+  size_t alignment, bytes;
+  if (plan_layout_(columns, column_count, flags, arena->memory_, arena->position_,
+                   arena->remapping ? SIZE_MAX : arena->total_size_, arena->auto_align_ ? arena->alignment_ : 1, &alignment, &bytes)) {
+    return NULL;
+  }
+  GUARD_SUSPEND();
+  uint8_t* mem = Push_VirtualArena(arena, bytes);
+  GUARD_RESUME();
+  return place_layout_(mem, columns, column_count, flags, alignment, columns_out);
+}
+
+// A push that opens a new chunk gets the worst case padding, same as the large block case
+uint8_t* PushLayoutNoZero_ChainedArena(ChainedArena* arena, const ColumnDesc* columns, size_t column_count, int flags, void** columns_out) {
+  size_t alignment, bytes;
+  if (plan_layout_(columns, column_count, flags, arena->memory_, arena->position_, arena->total_size_,
+                   arena->auto_align_ ? arena->alignment_ : 1, &alignment, &bytes)) {
+    return NULL;
+  }
+  GUARD_SUSPEND();
+  uint8_t* mem = PushNoZero_ChainedArena(arena, bytes);
+  GUARD_RESUME();
+  return place_layout_(mem, columns, column_count, flags, alignment, columns_out);
+}
+uint8_t* PushLayout_ChainedArena(ChainedArena* arena, const ColumnDesc* columns, size_t column_count, int flags, void** columns_out) {
+  size_t alignment, bytes;
+  if (plan_layout_(columns, column_count, flags, arena->memory_, arena->position_, arena->total_size_,
+                   arena->auto_align_ ? arena->alignment_ : 1, &alignment, &bytes)) {
+    return NULL;
+  }
+  GUARD_SUSPEND();
+  uint8_t* mem = Push_ChainedArena(arena, bytes);
+  GUARD_RESUME();
+  return place_layout_(mem, columns, column_count, flags, alignment, columns_out);
+}
+
+#endif
@@ -4,6 +4,7 @@
 // #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include "./profiler.h"
 #include "./utils.h"
 #ifdef _WIN32
 #ifdef __GNUC__
@@ -19,41 +20,50 @@
 typedef struct LargeMemBlock {
     uint8_t*              memory_;
     uintptr_t             block_size_;
-    uintptr_t             header_size_;
+    uintptr_t             header_size_;  // Everything mapped besides the block: header page, padding and color
     struct LargeMemBlock* next_block_;
 } LargeMemBlock;
 
-LargeMemBlock* Create_LargeMemBlock(int block_size, LargeMemBlock* next_block) {
+LargeMemBlock* Create_LargeMemBlock(size_t block_size, LargeMemBlock* next_block) {
   // Error code NULL if memory failed to allocate
 #ifdef DEBUG
   if (block_size < _getPageSize()) {
-    return ERROR_INVALID_PARAMS;
+    return NULL;
   }
 #endif
-  uintptr_t total_size = align_2pow(align_2pow(block_size, _getPageSize()) + sizeof(LargeMemBlock), _getPageSize());
-  uint8_t*  mem        = os_new_virtual_mapping_commit(total_size);
+  size_t total_size;
+  size_t color = NEXT_CACHE_COLOR();
+  // The header always fits in a single page in front of the block, the color is left unused behind it
+  if (size_add_overflow(block_size, color, &total_size) || align_2pow_overflow(total_size, _getPageSize(), &total_size) ||
+      size_add_overflow(total_size, _getPageSize(), &total_size)) {
+    DEBUG_PRINT("Large block size overflows");
+    return NULL;
+  }
+  uint8_t* mem = os_new_virtual_mapping_commit(total_size);
   if (mem == NULL) {
     return NULL;
   }
   LargeMemBlock* block = (LargeMemBlock*)mem;
   block->block_size_   = block_size;
   block->header_size_  = total_size - block_size;
-  block->memory_       = mem + block->header_size_;
+  block->memory_       = mem + block->header_size_ - color;
   block->next_block_   = next_block;
-  os_protect_readonly(mem, block->header_size_);
+  // Only the header page, the block memory is right-aligned and may start inside the second page
+  os_protect_readonly(mem, _getPageSize());
   return block;
 }
 
 LargeMemBlock* Pop_LargeMemoryBlock(LargeMemBlock* block) {
 #ifdef DEBUG
   if (block == NULL) {
-    return ERROR_INVALID_PARAMS;
+    return NULL;
   }
 #endif
   LargeMemBlock* next_block  = block->next_block_;
   uint8_t*       mem         = (uint8_t*)block;
   uintptr_t      block_size  = block->block_size_;
   uintptr_t      header_size = block->header_size_;
+  PROFILE_POP(block, 0);
   os_protect_readwrite(block, block->header_size_);
   block->memory_      = NULL;
   block->block_size_  = 0;
@@ -67,11 +77,10 @@ LargeMemBlock* Pop_LargeMemoryBlock(LargeMemBlock* block) {
 }
 
 int Destroy_LargeMemBlocks(LargeMemBlock* block) {
-#ifdef DEBUG
+  // An empty chain is valid, arenas without large blocks end up here on destruction
   if (block == NULL) {
-    return ERROR_INVALID_PARAMS;
+    return SUCCESS;
   }
-#endif
   if (block->next_block_ != NULL) {
     if (Destroy_LargeMemBlocks(block->next_block_) == ERROR_INVALID_PARAMS) {
       DEBUG_PRINT("Bad params in destructor loop");
@@ -80,6 +89,7 @@ int Destroy_LargeMemBlocks(LargeMemBlock* block) {
   uint8_t*  mem         = (uint8_t*)block;
   uintptr_t block_size  = block->block_size_;
   uintptr_t header_size = block->header_size_;
+  PROFILE_POP(block, 0);
   os_protect_readwrite(block, header_size);
   block->memory_      = NULL;
   block->block_size_  = 0;
@@ -91,6 +101,20 @@ int Destroy_LargeMemBlocks(LargeMemBlock* block) {
   return SUCCESS;
 }
 
+// Same as Merge_LargeMemBlocks when the last block of the first chain is known, without the walk
+LargeMemBlock* Splice_LargeMemBlocks(LargeMemBlock* first, LargeMemBlock* first_tail, LargeMemBlock* second) {
+  if (NULL == second) {
+    return first;
+  }
+  if (NULL == first) {
+    return second;
+  }
+  os_protect_readwrite(first_tail, first_tail->header_size_);
+  first_tail->next_block_ = second;
+  os_protect_readonly(first_tail, _getPageSize());
+  return first;
+}
+
 LargeMemBlock* Merge_LargeMemBlocks(LargeMemBlock* first, LargeMemBlock* second) {
   if (NULL == second) {
     // If both are NULL, return is NULL
@@ -104,11 +128,7 @@ LargeMemBlock* Merge_LargeMemBlocks(LargeMemBlock* first, LargeMemBlock* second)
   while (traversed->next_block_ != NULL) {
     traversed = traversed->next_block_;
   }
-
-  os_protect_readwrite(traversed, traversed->header_size_);
-  traversed->next_block_ = second;
-  os_protect_readonly(traversed, traversed->header_size_);
-  return first;
+  return Splice_LargeMemBlocks(first, traversed, second);
 }
 
 #endif
\ No newline at end of file
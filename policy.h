@@ -0,0 +1,173 @@
+#ifndef _POLICY_ABERLLOC_HEADER
+#define _POLICY_ABERLLOC_HEADER
+#include <stdint.h>
+#include <stdlib.h>
+#include "./utils.h"
+// Commit growth and shrink policies. Every committing arena points to one, so arenas with different usage patterns
+// can be tuned separately. The presets are stateless and can be shared, except the adaptive one which learns from the
+// arena it is attached to.
+// Both hooks return a commit size, page aligned and never below a page. Extend gets the size that must be covered
+// at least, reduce gets the position before and after a pop and returns committed_size to keep everything.
+
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)  // x86-64 and most ARM64 kernels
+
+typedef struct ArenaPolicy {
+    size_t (*extend_)(struct ArenaPolicy* policy, size_t committed_size, size_t required_size);
+    size_t (*reduce_)(struct ArenaPolicy* policy, size_t committed_size, size_t previous_position, size_t position);
+    size_t step_;        // Growth step or granularity, depending on the preset
+    size_t peak_;        // Adaptive only: decaying high-water mark of the position
+    int    huge_pages_;  // Ask the OS for transparent huge pages on the arena
+} ArenaPolicy;
+
+static size_t clamp_commit_(size_t size, size_t granularity) {
+  if (size < _getPageSize()) {
+    size = _getPageSize();
+  }
+  size_t aligned;
+  if (align_2pow_overflow(size, granularity, &aligned)) {
+    return SIZE_MAX & ~(granularity - 1);
+  }
+  return aligned;
+}
+
+// Geometric: x4 on growth, halves while the commit is 4 times the usage or more. The historical behaviour.
+static size_t Extend_GeometricPolicy(ArenaPolicy* policy, size_t committed_size, size_t required_size) {
+  (void)policy;
+  size_t size = committed_size;
+  while (size < required_size && size != SIZE_MAX) {
+    size = extendPolicy(size);
+  }
+  return clamp_commit_(size, _getPageSize());
+}
+static size_t Reduce_GeometricPolicy(ArenaPolicy* policy, size_t committed_size, size_t previous_position, size_t position) {
+  (void)policy;
+  (void)previous_position;
+  size_t size = committed_size;
+  while (size > _getPageSize() && (position == 0 || reduceCondition(position, size))) {
+    size = reducePolicy(size);
+  }
+  return clamp_commit_(size, _getPageSize());
+}
+
+// Linear: grows in increments of step_, only shrinks when more than two steps are unused
+static size_t Extend_LinearPolicy(ArenaPolicy* policy, size_t committed_size, size_t required_size) {
+  size_t size = committed_size;
+  while (size < required_size) {
+    if (size_add_overflow(size, policy->step_, &size)) {
+      return clamp_commit_(required_size, _getPageSize());
+    }
+  }
+  return clamp_commit_(size, _getPageSize());
+}
+static size_t Reduce_LinearPolicy(ArenaPolicy* policy, size_t committed_size, size_t previous_position, size_t position) {
+  (void)previous_position;
+  if (committed_size - position <= 2 * policy->step_) {
+    return committed_size;
+  }
+  return clamp_commit_(position + policy->step_, _getPageSize());
+}
+
+// Fixed step: commits exactly what is used, rounded to step_, in both directions
+static size_t Extend_FixedStepPolicy(ArenaPolicy* policy, size_t committed_size, size_t required_size) {
+  (void)committed_size;
+  return clamp_commit_(required_size, policy->step_);
+}
+static size_t Reduce_FixedStepPolicy(ArenaPolicy* policy, size_t committed_size, size_t previous_position, size_t position) {
+  (void)previous_position;
+  size_t size = clamp_commit_(position, policy->step_);
+  return size < committed_size ? size : committed_size;
+}
+
+// Huge page granular: geometric, but every commit is a whole number of huge pages so none gets split
+static size_t Extend_HugePagePolicy(ArenaPolicy* policy, size_t committed_size, size_t required_size) {
+  return clamp_commit_(Extend_GeometricPolicy(policy, committed_size, required_size), HUGE_PAGE_SIZE);
+}
+static size_t Reduce_HugePagePolicy(ArenaPolicy* policy, size_t committed_size, size_t previous_position, size_t position) {
+  size_t size = clamp_commit_(Reduce_GeometricPolicy(policy, committed_size, previous_position, position), HUGE_PAGE_SIZE);
+  return size < committed_size ? size : committed_size;
+}
+
+// Adaptive: remembers a decaying peak of the position (the position right before a pop is a high-water mark) and
+// keeps the commit around it, with a 25% margin. Growth goes straight to the peak (at least doubling past it),
+// shrinking only happens when the commit is 50% above the target, so an arena cycling through the same working set
+// stops committing and decommitting after the first cycle.
+static size_t Extend_AdaptivePolicy(ArenaPolicy* policy, size_t committed_size, size_t required_size) {
+  if (required_size <= policy->peak_) {
+    return clamp_commit_(policy->peak_ + policy->peak_ / 4, _getPageSize());
+  }
+  size_t size = required_size;
+  if (size <= SIZE_MAX - size / 4) {
+    size += size / 4;
+  }
+  if (committed_size <= SIZE_MAX / 2 && size < committed_size * 2) {
+    size = committed_size * 2;
+  }
+  return clamp_commit_(size, _getPageSize());
+}
+static size_t Reduce_AdaptivePolicy(ArenaPolicy* policy, size_t committed_size, size_t previous_position, size_t position) {
+  (void)position;
+  size_t decayed = policy->peak_ - policy->peak_ / 16;
+  policy->peak_  = previous_position > decayed ? previous_position : decayed;
+  size_t target  = clamp_commit_(policy->peak_ + policy->peak_ / 4, _getPageSize());
+  if (committed_size - committed_size / 3 <= target) {
+    return committed_size;
+  }
+  return target;
+}
+
+int Init_GeometricPolicy(ArenaPolicy* policy) {
+  policy->extend_     = Extend_GeometricPolicy;
+  policy->reduce_     = Reduce_GeometricPolicy;
+  policy->step_       = 0;
+  policy->peak_       = 0;
+  policy->huge_pages_ = FALSE;
+  return SUCCESS;
+}
+int Init_LinearPolicy(ArenaPolicy* policy, size_t step) {
+#ifdef DEBUG
+  if (policy == NULL || step == 0) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  policy->extend_     = Extend_LinearPolicy;
+  policy->reduce_     = Reduce_LinearPolicy;
+  policy->step_       = align_2pow(step, _getPageSize());
+  policy->peak_       = 0;
+  policy->huge_pages_ = FALSE;
+  return SUCCESS;
+}
+int Init_FixedStepPolicy(ArenaPolicy* policy, size_t step) {
+#ifdef DEBUG
+  if (policy == NULL || __builtin_popcountll(step) != 1) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  policy->extend_     = Extend_FixedStepPolicy;
+  policy->reduce_     = Reduce_FixedStepPolicy;
+  policy->step_       = step < _getPageSize() ? _getPageSize() : step;
+  policy->peak_       = 0;
+  policy->huge_pages_ = FALSE;
+  return SUCCESS;
+}
+int Init_HugePagePolicy(ArenaPolicy* policy) {
+  policy->extend_     = Extend_HugePagePolicy;
+  policy->reduce_     = Reduce_HugePagePolicy;
+  policy->step_       = HUGE_PAGE_SIZE;
+  policy->peak_       = 0;
+  policy->huge_pages_ = TRUE;
+  return SUCCESS;
+}
+int Init_AdaptivePolicy(ArenaPolicy* policy) {
+  policy->extend_     = Extend_AdaptivePolicy;
+  policy->reduce_     = Reduce_AdaptivePolicy;
+  policy->step_       = 0;
+  policy->peak_       = 0;
+  policy->huge_pages_ = FALSE;
+  return SUCCESS;
+}
+
+// Used by arenas that never got a policy set. Each translation unit has its own copy, which is fine as geometric is
+// stateless, but editing it only affects the arenas of that unit: use SetPolicy_* instead.
+static ArenaPolicy DEFAULT_POLICY = {Extend_GeometricPolicy, Reduce_GeometricPolicy, 0, 0, FALSE};
+
+#endif
@@ -0,0 +1,272 @@
+#ifndef _POOL_ABERLLOC_HEADER
+#define _POOL_ABERLLOC_HEADER
+#include <stdint.h>
+#include <stdlib.h>
+#include "./static_arena.h"
+#include "./utils.h"
+#include "./virtual_arena.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+// Pool of fixed-size blocks carved from an arena. Occupancy lives in a separate bitmap (bit set = free), so the
+// blocks carry no headers and the metadata never shares a cache line with user data. Allocation takes the lowest free
+// blocks, which keeps the live set dense and cheap to iterate.
+// The memory belongs to the parent arena, the pool goes away when the arena is popped or cleared below it.
+// Single-threaded, except FreeRemote_FixedPool: other threads hand blocks back through a lock-free list that the owner
+// drains on its next allocation.
+typedef struct FixedPool {
+    uint8_t*  memory_;      // First block, cache line aligned
+    uint64_t* bitmap_;      // One bit per block, set when free. Padding bits past capacity_ are never set
+    size_t    block_size_;  // Word aligned
+    int       block_shift_; // log2(block_size_) when it is a power of two, -1 otherwise
+    size_t    capacity_;    // Blocks
+    size_t    word_count_;
+    size_t    hint_;  // No free bit below this word
+    size_t    used_;
+    // Blocks freed by other threads, linked through their first word. On its own line, producers write it all the time.
+    void* remote_ __attribute__((aligned(CACHE_LINE_SIZE)));
+} FixedPool;
+
+static void Fill_FixedPoolBitmap(FixedPool* pool) {
+  memset(pool->bitmap_, 0xFF, pool->word_count_ * sizeof(uint64_t));
+  if (pool->capacity_ % 64 != 0) {
+    pool->bitmap_[pool->word_count_ - 1] = ((uint64_t)1 << (pool->capacity_ % 64)) - 1;
+  }
+  pool->hint_ = 0;
+  pool->used_ = 0;
+}
+
+// Sizes of the two pushes, the bitmap is padded to a cache line so the blocks never share one with it
+static int Sizes_FixedPool(size_t block_size, size_t capacity, size_t* block_bytes, size_t* bitmap_bytes, size_t* aligned_block) {
+  if (block_size == 0 || capacity == 0 || align_2pow_overflow(block_size, WORD_SIZE, aligned_block)) {
+    return ERROR_INVALID_PARAMS;
+  }
+  if (size_mul_overflow(*aligned_block, capacity, block_bytes)) {
+    return ERROR_INVALID_PARAMS;
+  }
+  *bitmap_bytes = align_2pow((capacity + 63) / 64 * sizeof(uint64_t), CACHE_LINE_SIZE);
+  return SUCCESS;
+}
+
+static void Setup_FixedPool(FixedPool* pool, uint8_t* bitmap, uint8_t* blocks, size_t block_size, size_t capacity) {
+  pool->bitmap_      = (uint64_t*)bitmap;
+  pool->memory_      = blocks;
+  pool->block_size_  = block_size;
+  pool->block_shift_ = __builtin_popcountll(block_size) == 1 ? __builtin_ctzll(block_size) : -1;
+  pool->capacity_    = capacity;
+  pool->word_count_  = (capacity + 63) / 64;
+  pool->remote_      = NULL;
+  Fill_FixedPoolBitmap(pool);
+}
+
+int InitPool_StaticArena(FixedPool* pool, StaticArena* arena, size_t block_size, size_t capacity) {
+#ifdef DEBUG
+  if (pool == NULL || arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  size_t block_bytes, bitmap_bytes;
+  if (Sizes_FixedPool(block_size, capacity, &block_bytes, &bitmap_bytes, &block_size) != SUCCESS) {
+    return ERROR_INVALID_PARAMS;
+  }
+  uintptr_t position = arena->position_;
+  PushAlignerCacheLine_StaticArena(arena);
+  // Blocks are indexed from the pointer, a sampled push would not be inside the arena
+  GUARD_SUSPEND();
+  uint8_t* bitmap = PushNoZero_StaticArena(arena, bitmap_bytes);
+  uint8_t* blocks = bitmap != NULL ? PushNoZero_StaticArena(arena, block_bytes) : NULL;
+  GUARD_RESUME();
+  if (blocks == NULL) {
+    if (bitmap != NULL && arena->blocks_ != NULL && arena->blocks_->memory_ == bitmap) {
+      PopLargeBlock_StaticArena(arena);
+    }
+    PopTo_StaticArena(arena, position);
+    return ERROR_OS_MEMORY;
+  }
+  Setup_FixedPool(pool, bitmap, blocks, block_size, capacity);
+  return SUCCESS;
+}
+int InitPool_VirtualArena(FixedPool* pool, VirtualArena* arena, size_t block_size, size_t capacity) {
+#ifdef DEBUG
+  if (pool == NULL || arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  size_t block_bytes, bitmap_bytes;
+  if (Sizes_FixedPool(block_size, capacity, &block_bytes, &bitmap_bytes, &block_size) != SUCCESS) {
+    return ERROR_INVALID_PARAMS;
+  }
+  uintptr_t position = arena->position_;
+  PushAlignerCacheLine_VirtualArena(arena);
+  // Blocks are indexed from the pointer, a sampled push would not be inside the arena
+  GUARD_SUSPEND();
+  uint8_t* bitmap = PushNoZero_VirtualArena(arena, bitmap_bytes);
+  uint8_t* blocks = bitmap != NULL ? PushNoZero_VirtualArena(arena, block_bytes) : NULL;
+  GUARD_RESUME();
+  if (blocks == NULL) {
+    if (bitmap != NULL && arena->blocks_ != NULL && arena->blocks_->memory_ == bitmap) {
+      PopLargeBlock_VirtualArena(arena);
+    }
+    PopTo_VirtualArena(arena, position);
+    return ERROR_OS_MEMORY;
+  }
+  Setup_FixedPool(pool, bitmap, blocks, block_size, capacity);
+  return SUCCESS;
+}
+
+// First word at or after start with a bit set in bitmap ^ invert, word_count if none
+static size_t ScanWords_FixedPool(const uint64_t* bitmap, size_t start, size_t word_count, uint64_t invert) {
+  size_t word = start;
+#ifdef __AVX2__
+  __m256i flip = _mm256_set1_epi64x((long long)invert);
+  for (; word + 4 <= word_count; word += 4) {
+    __m256i words = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(bitmap + word)), flip);
+    if (!_mm256_testz_si256(words, words)) {
+      break;
+    }
+  }
+#endif
+  while (word < word_count && (bitmap[word] ^ invert) == 0) {
+    word++;
+  }
+  return word;
+}
+
+static inline size_t Index_FixedPool(FixedPool* pool, uint8_t* block) {
+  size_t offset = block - pool->memory_;
+  return pool->block_shift_ >= 0 ? offset >> pool->block_shift_ : offset / pool->block_size_;
+}
+
+// Owner side of the remote frees: takes the whole list at once, so producers never contend with the owner for a node
+// and there is no ABA. Returns the number of blocks returned to the pool.
+size_t DrainRemote_FixedPool(FixedPool* pool) {
+  void*  block   = __atomic_exchange_n(&pool->remote_, NULL, __ATOMIC_ACQUIRE);
+  size_t drained = 0;
+  while (block != NULL) {
+    void*  next  = *(void**)block;
+    size_t index = Index_FixedPool(pool, (uint8_t*)block);
+    pool->bitmap_[index / 64] |= (uint64_t)1 << (index % 64);
+    if (index / 64 < pool->hint_) {
+      pool->hint_ = index / 64;
+    }
+    block = next;
+    drained++;
+  }
+  pool->used_ -= drained;
+  return drained;
+}
+
+// Any thread but the owner. The block is linked through its first word, it must not be touched afterwards.
+void FreeRemote_FixedPool(FixedPool* pool, void* block) {
+  void* head = __atomic_load_n(&pool->remote_, __ATOMIC_RELAXED);
+  do {
+    *(void**)block = head;
+  } while (!__atomic_compare_exchange_n(&pool->remote_, &head, block, TRUE, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Fills blocks with up to count free blocks, lowest addresses first. Returns how many were allocated, fewer than
+// count only when the pool runs out.
+size_t AllocBatch_FixedPool(FixedPool* pool, void** blocks, size_t count) {
+#ifdef DEBUG
+  if (pool == NULL || blocks == NULL) {
+    return 0;
+  }
+#endif
+  if (__atomic_load_n(&pool->remote_, __ATOMIC_RELAXED) != NULL) {
+    DrainRemote_FixedPool(pool);
+  }
+  size_t taken = 0;
+  size_t word  = pool->hint_;
+  while (taken < count) {
+    word = ScanWords_FixedPool(pool->bitmap_, word, pool->word_count_, 0);
+    if (word == pool->word_count_) {
+      break;
+    }
+    uint64_t bits = pool->bitmap_[word];
+    while (bits != 0 && taken < count) {
+      size_t index    = word * 64 + __builtin_ctzll(bits);
+      blocks[taken++] = pool->memory_ + index * pool->block_size_;
+      bits &= bits - 1;
+    }
+    pool->bitmap_[word] = bits;
+    if (bits == 0) {
+      word++;
+    }
+  }
+  pool->hint_ = word;
+  pool->used_ += taken;
+  return taken;
+}
+uint8_t* Alloc_FixedPool(FixedPool* pool) {
+  void* block = NULL;
+  AllocBatch_FixedPool(pool, &block, 1);
+  return (uint8_t*)block;
+}
+
+int Free_FixedPool(FixedPool* pool, void* block) {
+#ifdef DEBUG
+  if (pool == NULL || (uint8_t*)block < pool->memory_ || (uint8_t*)block >= pool->memory_ + pool->capacity_ * pool->block_size_) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  size_t   index = Index_FixedPool(pool, (uint8_t*)block);
+  size_t   word  = index / 64;
+  uint64_t bit   = (uint64_t)1 << (index % 64);
+#ifdef DEBUG
+  if (pool->bitmap_[word] & bit) {
+    DEBUG_PRINT("Double free of block %zu", index);
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  pool->bitmap_[word] |= bit;
+  if (word < pool->hint_) {
+    pool->hint_ = word;
+  }
+  pool->used_--;
+  return SUCCESS;
+}
+int FreeBatch_FixedPool(FixedPool* pool, void** blocks, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    int result = Free_FixedPool(pool, blocks[i]);
+    if (result != SUCCESS) {
+      return result;
+    }
+  }
+  return SUCCESS;
+}
+
+// Marks every block free, the arena memory stays as is. Pending remote frees are dropped.
+int Clear_FixedPool(FixedPool* pool) {
+#ifdef DEBUG
+  if (pool == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  __atomic_store_n(&pool->remote_, NULL, __ATOMIC_RELAXED);
+  Fill_FixedPoolBitmap(pool);
+  return SUCCESS;
+}
+
+// Index of the first allocated block at or after index, capacity_ when there is none. For iterating the live set:
+//   for (size_t i = NextUsed_FixedPool(pool, 0); i < pool->capacity_; i = NextUsed_FixedPool(pool, i + 1))
+size_t NextUsed_FixedPool(FixedPool* pool, size_t index) {
+  if (index >= pool->capacity_) {
+    return pool->capacity_;
+  }
+  size_t   word = index / 64;
+  uint64_t used = ~pool->bitmap_[word] & (~(uint64_t)0 << (index % 64));
+  if (used == 0) {
+    word = ScanWords_FixedPool(pool->bitmap_, word + 1, pool->word_count_, ~(uint64_t)0);
+    if (word == pool->word_count_) {
+      return pool->capacity_;
+    }
+    used = ~pool->bitmap_[word];
+  }
+  index = word * 64 + __builtin_ctzll(used);
+  return index < pool->capacity_ ? index : pool->capacity_;
+}
+uint8_t* Block_FixedPool(FixedPool* pool, size_t index) {
+  return pool->memory_ + index * pool->block_size_;
+}
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef _PREFAULT_ABERLLOC_HEADER
+#define _PREFAULT_ABERLLOC_HEADER
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./policy.h"
+#include "./utils.h"
+#include "./virtual_arena.h"
+#ifdef _WIN32
+#ifdef __GNUC__
+#include <windows.h>
+// Compilation using msys2 env or similar
+#else
+#error "You need to compile with gcc."
+#endif
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+// Parallel page faulting and zeroing for huge pushes. The range is cut in huge page aligned chunks handed to a few
+// short-lived threads, the caller takes one too. Zeroing is a memset per chunk, faulting without zeroing uses
+// MADV_POPULATE_WRITE where the kernel has it and touches every page otherwise. Ranges below
+// PREFAULT_MIN_CHUNK per thread stay on the calling thread, thread creation would cost more than it saves.
+// Without PREFAULT_LOCAL_NODE pages land on the node of whichever thread faults them first. With it the arena pushes
+// bind the whole reservation (or the whole large block) once, binding only the pushed pages would split the mapping on
+// every push and change the policy of the neighbouring data sharing its first and last page.
+// Single-threaded, the arena functions must be called by the arena owner like every other push.
+
+#ifndef ABERLLOC_PREFAULT_THREADS
+#define ABERLLOC_PREFAULT_THREADS 16  // Upper bound, the online CPU count is used when lower
+#endif
+#define PREFAULT_MIN_CHUNK ((size_t)64 * 1024 * 1024)
+
+// Flags
+#define PREFAULT_ZERO       1  // The range may hold old data, memset it
+#define PREFAULT_LOCAL_NODE 2  // Prefer the caller's NUMA node for the whole arena or block (Linux), arena pushes only
+
+#if defined(__linux__) && !defined(MADV_POPULATE_WRITE)
+#define MADV_POPULATE_WRITE 23  // Linux 5.14, older kernels answer EINVAL and we touch the pages instead
+#endif
+
+typedef struct PrefaultTask {
+    uint8_t* memory_;
+    size_t   bytes_;
+    int      zero_;
+} PrefaultTask;
+
+static void* Run_PrefaultTask(void* argument) {
+  PrefaultTask* task = (PrefaultTask*)argument;
+  if (task->zero_) {
+    memset(task->memory_, 0, task->bytes_);
+    return NULL;
+  }
+#ifdef MADV_POPULATE_WRITE
+  // Whole pages, the range shares its first and last page with memory of the same mapping and contents do not change
+  uintptr_t start = (uintptr_t)task->memory_ & ~(_getPageSize() - 1);
+  uintptr_t end   = align_2pow((uintptr_t)task->memory_ + task->bytes_, _getPageSize());
+  if (madvise((void*)start, end - start, MADV_POPULATE_WRITE) == 0) {
+    return NULL;
+  }
+#endif
+  for (size_t offset = 0; offset < task->bytes_; offset += _getPageSize()) {
+    ((volatile uint8_t*)task->memory_)[offset] = 0;
+  }
+  if (task->bytes_ > 0) {
+    ((volatile uint8_t*)task->memory_)[task->bytes_ - 1] = 0;
+  }
+  return NULL;
+}
+
+// Prefers the caller's node for a whole mapping (page aligned), unless it already does. MPOL_PREFERRED falls back to
+// other nodes instead of failing when the local one is full.
+int BindLocalNode_Memory(void* mapping, size_t size) {
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_getcpu) && defined(SYS_get_mempolicy)
+  unsigned int  cpu, node;
+  unsigned long mask[4]  = {0};
+  unsigned long bound[4] = {0};
+  int           mode     = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= sizeof(mask) * 8) {
+    return ERROR_INVALID_PARAMS;
+  }
+  mask[node / (sizeof(unsigned long) * 8)] |= 1UL << (node % (sizeof(unsigned long) * 8));
+  // MPOL_F_ADDR, the policy of the mapping holding the address
+  if (syscall(SYS_get_mempolicy, &mode, bound, sizeof(bound) * 8, mapping, 2) == 0 && mode == 1 &&
+      memcmp(bound, mask, sizeof(mask)) == 0) {
+    return SUCCESS;
+  }
+  if (syscall(SYS_mbind, mapping, size, 1, mask, sizeof(mask) * 8, 0) != 0) {
+    DEBUG_PRINT("mbind to the local node failed, continuing with first touch");
+    return ERROR_OS_MEMORY;
+  }
+  return SUCCESS;
+#else
+  (void)mapping;
+  (void)size;
+  return SUCCESS;
+#endif
+}
+
+static size_t prefault_threads_(size_t bytes) {
+  size_t threads = bytes / PREFAULT_MIN_CHUNK;
+#ifdef _WIN32
+  threads = 1;
+#else
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  if (online > 0 && threads > (size_t)online) {
+    threads = (size_t)online;
+  }
+#endif
+  if (threads > ABERLLOC_PREFAULT_THREADS) {
+    threads = ABERLLOC_PREFAULT_THREADS;
+  }
+  return threads > 0 ? threads : 1;
+}
+
+// Faults in (and with PREFAULT_ZERO, zeroes) a range of any memory, in parallel when it is large enough.
+// PREFAULT_LOCAL_NODE is ignored, only the owner of the whole mapping can bind it: see BindLocalNode_Memory.
+int Prefault_Memory(uint8_t* memory, size_t bytes, int flags) {
+#ifdef DEBUG
+  if (memory == NULL && bytes != 0) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  PrefaultTask tasks[ABERLLOC_PREFAULT_THREADS];
+  size_t       threads = prefault_threads_(bytes);
+  size_t       chunk   = align_2pow(bytes / threads, HUGE_PAGE_SIZE);
+  size_t       count   = 0;
+  for (size_t offset = 0; offset < bytes && count < threads; count++) {
+    tasks[count].memory_ = memory + offset;
+    tasks[count].bytes_  = bytes - offset < chunk || count == threads - 1 ? bytes - offset : chunk;
+    tasks[count].zero_   = flags & PREFAULT_ZERO;
+    offset += tasks[count].bytes_;
+  }
+#ifndef _WIN32
+  pthread_t workers[ABERLLOC_PREFAULT_THREADS];
+  int       running[ABERLLOC_PREFAULT_THREADS] = {0};
+  size_t    started = 0;
+  // The caller runs task 0, a worker that cannot be started leaves its task to the caller as well
+  for (size_t i = 1; i < count; i++) {
+    if (pthread_create(&workers[started], NULL, Run_PrefaultTask, &tasks[i]) == 0) {
+      started++;
+      running[i] = TRUE;
+    }
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (!running[i]) {
+      Run_PrefaultTask(&tasks[i]);
+    }
+  }
+  for (size_t i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+#else
+  for (size_t i = 0; i < count; i++) {
+    Run_PrefaultTask(&tasks[i]);
+  }
+#endif
+  return SUCCESS;
+}
+
+// Binds the mapping the push landed in, the arena reservation or a fresh large block. Returns TRUE for the block.
+static int bind_pushed_(VirtualArena* arena, uint8_t* mem, int flags) {
+  int fresh = arena->blocks_ != NULL && arena->blocks_->memory_ == mem;
+  if (flags & PREFAULT_LOCAL_NODE) {
+    if (fresh) {
+      BindLocalNode_Memory(arena->blocks_, arena->blocks_->header_size_ + arena->blocks_->block_size_);
+    } else {
+      BindLocalNode_Memory(arena->memory_, arena->total_size_);
+    }
+  }
+  return fresh;
+}
+
+// Same as Push_VirtualArena with the zeroing spread over threads. A push that falls back to a large block gets a fresh
+// mapping, which is already zero, so it is only faulted in.
+uint8_t* PushParallel_VirtualArena(VirtualArena* arena, size_t bytes, int flags) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return NULL;
+  }
+#endif
+  uint8_t* mem = PushNoZero_VirtualArena(arena, bytes);
+  if (mem == NULL) {
+    return NULL;
+  }
+  int fresh = bind_pushed_(arena, mem, flags);
+  Prefault_Memory(mem, bytes, fresh ? flags & ~PREFAULT_ZERO : flags | PREFAULT_ZERO);
+  return mem;
+}
+uint8_t* PushParallelNoZero_VirtualArena(VirtualArena* arena, size_t bytes, int flags) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return NULL;
+  }
+#endif
+  uint8_t* mem = PushNoZero_VirtualArena(arena, bytes);
+  if (mem == NULL) {
+    return NULL;
+  }
+  bind_pushed_(arena, mem, flags);
+  Prefault_Memory(mem, bytes, flags & ~PREFAULT_ZERO);
+  return mem;
+}
+// Same as PushLargeBlock_VirtualArena, faulted in over threads. The mapping is fresh, PREFAULT_ZERO is never needed.
+uint8_t* PushLargeBlockParallel_VirtualArena(VirtualArena* arena, size_t bytes, int flags) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return NULL;
+  }
+#endif
+  uint8_t* mem = PushLargeBlock_VirtualArena(arena, bytes);
+  if (mem == NULL) {
+    return NULL;
+  }
+  bind_pushed_(arena, mem, flags);
+  Prefault_Memory(mem, bytes, flags & ~PREFAULT_ZERO);
+  return mem;
+}
+
+#endif
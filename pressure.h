@@ -0,0 +1,273 @@
+#ifndef _PRESSURE_ABERLLOC_HEADER
+#define _PRESSURE_ABERLLOC_HEADER
+#include <stdint.h>
+#include <stdlib.h>
+#include "./utils.h"
+// Memory pressure awareness, compiled in with ABERLLOC_PRESSURE. A monitor thread watches the cgroup v2 PSI triggers
+// in memory.pressure and memory.current against memory.high (or memory.max), and publishes a process-wide level.
+// Arenas read the level on their own thread when they pop: under pressure the commit policy is overridden and only
+// the pages under the position (plus some headroom when moderate) stay committed, and cached chunks and recycled
+// arenas are dropped. Idle arenas can be trimmed explicitly, and caches owned by other threads register callbacks,
+// which run on the monitor thread.
+// Without the flag PRESSURE_LEVEL() is a constant and every check compiles away.
+
+#define PRESSURE_NONE     0
+#define PRESSURE_MODERATE 1  // Keep a quarter of the position as headroom, do not recycle
+#define PRESSURE_CRITICAL 2  // Keep only what is in use, drop every cache
+
+#ifdef ABERLLOC_PRESSURE
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef ABERLLOC_PRESSURE_INTERVAL_MS
+#define ABERLLOC_PRESSURE_INTERVAL_MS 1000  // Re-reads the averages and usage, the level decays at this pace
+#endif
+#ifndef ABERLLOC_PRESSURE_WINDOW_US
+#define ABERLLOC_PRESSURE_WINDOW_US 2000000  // PSI trigger window, unprivileged triggers need a multiple of 2 s
+#endif
+#ifndef ABERLLOC_PRESSURE_STALL_US
+#define ABERLLOC_PRESSURE_STALL_US 100000  // Stall per window that fires a trigger
+#endif
+#define PRESSURE_SOME_AVG10       10.0  // % of time some task stalled on memory, moderate above
+#define PRESSURE_FULL_AVG10       5.0   // % of time all tasks stalled, critical above
+#define PRESSURE_MODERATE_PERCENT 90    // memory.current against memory.high
+#define PRESSURE_CRITICAL_PERCENT 98
+#define PRESSURE_MAX_CALLBACKS    16
+
+typedef void (*PressureCallback)(void* context, int level);
+
+typedef struct PressureMonitor {
+    pthread_t        thread_;
+    int              running_;
+    int              some_fd_;  // PSI triggers, -1 when unavailable
+    int              full_fd_;
+    int              stop_fd_[2];
+    char             cgroup_[512];  // cgroup v2 directory, empty outside one
+    char             pressure_[640];
+    PressureCallback callbacks_[PRESSURE_MAX_CALLBACKS];
+    void*            contexts_[PRESSURE_MAX_CALLBACKS];
+    int              callback_count_;
+    size_t           events_;  // Level rises seen, for monitoring
+} PressureMonitor;
+
+static PressureMonitor PRESSURE_MONITOR;
+static int             PRESSURE_CURRENT = PRESSURE_NONE;
+
+#define PRESSURE_LEVEL() __atomic_load_n(&PRESSURE_CURRENT, __ATOMIC_RELAXED)
+
+static int read_text_(const char* path, char* text, size_t size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return FALSE;
+  }
+  ssize_t length = read(fd, text, size - 1);
+  close(fd);
+  if (length <= 0) {
+    return FALSE;
+  }
+  text[length] = '\0';
+  return TRUE;
+}
+
+static void find_cgroup_(PressureMonitor* monitor) {
+  char text[1024];
+  monitor->cgroup_[0] = '\0';
+  snprintf(monitor->pressure_, sizeof(monitor->pressure_), "/proc/pressure/memory");
+  if (!read_text_("/proc/self/cgroup", text, sizeof(text))) {
+    return;
+  }
+  // The v2 hierarchy is the "0::/path" line
+  char* line = strstr(text, "0::");
+  if (line == NULL || (line != text && line[-1] != '\n')) {
+    return;
+  }
+  line += 3;
+  line[strcspn(line, "\n")] = '\0';
+  snprintf(monitor->cgroup_, sizeof(monitor->cgroup_), "/sys/fs/cgroup%s", strcmp(line, "/") == 0 ? "" : line);
+  char path[640];
+  snprintf(path, sizeof(path), "%s/memory.pressure", monitor->cgroup_);
+  if (access(path, R_OK) == 0) {
+    snprintf(monitor->pressure_, sizeof(monitor->pressure_), "%s", path);
+  }
+}
+
+static int open_trigger_(const char* path, const char* kind) {
+  char trigger[64];
+  int  fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  int length = snprintf(trigger, sizeof(trigger), "%s %d %d", kind, ABERLLOC_PRESSURE_STALL_US, ABERLLOC_PRESSURE_WINDOW_US);
+  if (write(fd, trigger, (size_t)length + 1) < 0) {
+    DEBUG_PRINT("PSI trigger refused, falling back to polling");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Bytes in a cgroup file, SIZE_MAX for "max" or when missing
+static size_t read_cgroup_size_(PressureMonitor* monitor, const char* name) {
+  char path[640], text[64];
+  if (monitor->cgroup_[0] == '\0') {
+    return SIZE_MAX;
+  }
+  snprintf(path, sizeof(path), "%s/%s", monitor->cgroup_, name);
+  if (!read_text_(path, text, sizeof(text)) || text[0] < '0' || text[0] > '9') {
+    return SIZE_MAX;
+  }
+  return (size_t)strtoull(text, NULL, 10);
+}
+
+static int Sample_PressureMonitor(PressureMonitor* monitor) {
+  int    level = PRESSURE_NONE;
+  char   text[256];
+  double some = 0, full = 0;
+  if (read_text_(monitor->pressure_, text, sizeof(text))) {
+    char* line = strstr(text, "some avg10=");
+    if (line != NULL) {
+      some = strtod(line + 11, NULL);
+    }
+    line = strstr(text, "full avg10=");
+    if (line != NULL) {
+      full = strtod(line + 11, NULL);
+    }
+  }
+  if (full >= PRESSURE_FULL_AVG10) {
+    level = PRESSURE_CRITICAL;
+  } else if (some >= PRESSURE_SOME_AVG10) {
+    level = PRESSURE_MODERATE;
+  }
+  size_t limit = read_cgroup_size_(monitor, "memory.high");
+  if (limit == SIZE_MAX) {
+    limit = read_cgroup_size_(monitor, "memory.max");
+  }
+  size_t current = read_cgroup_size_(monitor, "memory.current");
+  if (limit != SIZE_MAX && current != SIZE_MAX) {
+    if (current >= limit / 100 * PRESSURE_CRITICAL_PERCENT) {
+      level = PRESSURE_CRITICAL;
+    } else if (current >= limit / 100 * PRESSURE_MODERATE_PERCENT && level < PRESSURE_MODERATE) {
+      level = PRESSURE_MODERATE;
+    }
+  }
+  return level;
+}
+
+// Publishes a level, callbacks run when it rises. Also for applications with their own signals (or tests).
+void SetLevel_PressureMonitor(int level) {
+  int previous = __atomic_exchange_n(&PRESSURE_CURRENT, level, __ATOMIC_RELAXED);
+  if (level <= previous) {
+    return;
+  }
+  __atomic_fetch_add(&PRESSURE_MONITOR.events_, 1, __ATOMIC_RELAXED);
+  int count = __atomic_load_n(&PRESSURE_MONITOR.callback_count_, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < count; i++) {
+    PRESSURE_MONITOR.callbacks_[i](PRESSURE_MONITOR.contexts_[i], level);
+  }
+}
+
+static void* Run_PressureMonitor(void* argument) {
+  PressureMonitor* monitor = (PressureMonitor*)argument;
+  struct pollfd    fds[3]  = {{monitor->stop_fd_[0], POLLIN, 0}, {monitor->some_fd_, POLLPRI, 0}, {monitor->full_fd_, POLLPRI, 0}};
+  for (;;) {
+    // Negative descriptors are skipped by poll
+    int ready = poll(fds, 3, ABERLLOC_PRESSURE_INTERVAL_MS);
+    if (ready > 0 && (fds[0].revents & POLLIN)) {
+      break;
+    }
+    int level = Sample_PressureMonitor(monitor);
+    if (ready > 0 && (fds[1].revents & POLLPRI) && level < PRESSURE_MODERATE) {
+      level = PRESSURE_MODERATE;
+    }
+    if (ready > 0 && (fds[2].revents & POLLPRI)) {
+      level = PRESSURE_CRITICAL;
+    }
+    if (ready > 0 && ((fds[1].revents | fds[2].revents) & (POLLERR | POLLNVAL))) {
+      // The cgroup went away, keep sampling
+      fds[1].fd = -1;
+      fds[2].fd = -1;
+    }
+    SetLevel_PressureMonitor(level);
+  }
+  return NULL;
+}
+
+// Callbacks must be thread-safe, they run on the monitor thread. Register from a single thread.
+int AddCallback_PressureMonitor(PressureCallback callback, void* context) {
+  int count = PRESSURE_MONITOR.callback_count_;
+  if (callback == NULL || count == PRESSURE_MAX_CALLBACKS) {
+    return ERROR_INVALID_PARAMS;
+  }
+  PRESSURE_MONITOR.callbacks_[count] = callback;
+  PRESSURE_MONITOR.contexts_[count]  = context;
+  __atomic_store_n(&PRESSURE_MONITOR.callback_count_, count + 1, __ATOMIC_RELEASE);
+  return SUCCESS;
+}
+
+int Start_PressureMonitor(void) {
+  PressureMonitor* monitor = &PRESSURE_MONITOR;
+  if (monitor->running_) {
+    return SUCCESS;
+  }
+  if (pipe(monitor->stop_fd_) != 0) {
+    return ERROR_OS_MEMORY;
+  }
+  find_cgroup_(monitor);
+  monitor->some_fd_ = open_trigger_(monitor->pressure_, "some");
+  monitor->full_fd_ = open_trigger_(monitor->pressure_, "full");
+  if (pthread_create(&monitor->thread_, NULL, Run_PressureMonitor, monitor) != 0) {
+    close(monitor->stop_fd_[0]);
+    close(monitor->stop_fd_[1]);
+    return ERROR_OS_MEMORY;
+  }
+  monitor->running_ = TRUE;
+  return SUCCESS;
+}
+
+int Stop_PressureMonitor(void) {
+  PressureMonitor* monitor = &PRESSURE_MONITOR;
+  if (!monitor->running_) {
+    return SUCCESS;
+  }
+  char stop = 1;
+  if (write(monitor->stop_fd_[1], &stop, 1) != 1) {
+    return ERROR_OS_MEMORY;
+  }
+  pthread_join(monitor->thread_, NULL);
+  close(monitor->stop_fd_[0]);
+  close(monitor->stop_fd_[1]);
+  if (monitor->some_fd_ >= 0) {
+    close(monitor->some_fd_);
+  }
+  if (monitor->full_fd_ >= 0) {
+    close(monitor->full_fd_);
+  }
+  monitor->running_ = FALSE;
+  __atomic_store_n(&PRESSURE_CURRENT, PRESSURE_NONE, __ATOMIC_RELAXED);
+  return SUCCESS;
+}
+#else
+#define PRESSURE_LEVEL() PRESSURE_NONE
+#endif
+
+// Commit an arena keeps after a pop, given what its policy wants to keep
+static inline size_t pressure_commit_(size_t target, uintptr_t position) {
+  int level = PRESSURE_LEVEL();
+  if (level == PRESSURE_NONE) {
+    return target;
+  }
+  size_t keep = position;
+  if (level == PRESSURE_MODERATE && size_add_overflow(position, position / 4, &keep)) {
+    return target;
+  }
+  if (align_2pow_overflow(keep < _getPageSize() ? _getPageSize() : keep, _getPageSize(), &keep)) {
+    return target;
+  }
+  return keep < target ? keep : target;
+}
+
+#endif
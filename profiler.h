@@ -0,0 +1,411 @@
+#ifndef _PROFILER_ABERLLOC_HEADER
+#define _PROFILER_ABERLLOC_HEADER
+#include <stdint.h>
+#include <stdlib.h>
+#include "./utils.h"
+// Sampling heap profiler, compiled in with ABERLLOC_PROFILE. Pushes are sampled by bytes with exponentially
+// distributed intervals of mean ABERLLOC_PROFILE_INTERVAL (Poisson sampling, as tcmalloc does), so the chance of a
+// push being sampled grows with its size and the cost of the common path is a thread-local subtraction.
+// Every sample keeps a backtrace and is attributed to its (arena, call stack) pair. Samples stay in use until the
+// arena is popped below them, which works because the samples of an arena are a stack like the arena itself. Pushes
+// that fell back to a large block are owned by the block instead, and stay in use until it is freed.
+// Dump_HeapProfile writes the legacy pprof heap format (pprof --text binary file), also requested through a signal.
+// Summary_HeapProfile writes estimated bytes per arena.
+// Thread-safe, the tables are shared and taken under a spinlock on samples, and on pops while samples are in use.
+
+#ifdef ABERLLOC_PROFILE
+#ifdef _WIN32
+#error "The profiler needs execinfo backtraces"
+#endif
+#include <execinfo.h>
+#include <signal.h>
+#include <stdio.h>
+
+#ifndef ABERLLOC_PROFILE_INTERVAL
+#define ABERLLOC_PROFILE_INTERVAL (512 * 1024)  // Mean bytes between samples
+#endif
+#ifndef ABERLLOC_PROFILE_DEPTH
+#define ABERLLOC_PROFILE_DEPTH 32
+#endif
+#define PROFILE_STACKS  4096   // Distinct (arena, stack) pairs, power of two
+#define PROFILE_ARENAS  1024   // Arenas with samples in use, power of two
+#define PROFILE_SAMPLES 65536  // Samples in use
+#define PROFILE_NONE    UINT32_MAX
+
+typedef struct ProfileStack {
+    const void* arena_;  // NULL if the entry is unused
+    void*       frames_[ABERLLOC_PROFILE_DEPTH];
+    int         depth_;
+    uint64_t    alloc_count_;
+    uint64_t    alloc_bytes_;
+    uint64_t    inuse_count_;
+    uint64_t    inuse_bytes_;
+} ProfileStack;
+
+typedef struct ProfileSample {
+    uint64_t position_;  // Arena position the push started at
+    uint64_t bytes_;
+    uint32_t stack_;
+    uint32_t below_;  // Previous sample of the same arena, or the next free sample
+} ProfileSample;
+
+typedef struct ProfileArena {
+    const void* arena_;
+    uint32_t    top_;  // Latest sample in use
+} ProfileArena;
+
+typedef struct HeapProfile {
+    ProfileStack          stacks_[PROFILE_STACKS];
+    ProfileArena          arenas_[PROFILE_ARENAS];
+    ProfileSample         samples_[PROFILE_SAMPLES];
+    uint32_t              free_sample_;
+    size_t                stack_count_;
+    size_t                live_;  // Samples in use, pops skip the lock while 0
+    uint64_t              dropped_;
+    int                   lock_;
+    int                   initialised_;
+    const char*           signal_path_;
+    volatile sig_atomic_t dump_requested_;  // Set by the signal handler
+} HeapProfile;
+
+static HeapProfile      HEAP_PROFILE;
+static __thread int64_t PROFILE_COUNTDOWN = 0;
+static __thread uint64_t PROFILE_RANDOM   = 0;
+static __thread int     PROFILE_SUSPENDED = 0;
+
+static void Lock_HeapProfile(void) {
+  while (__atomic_exchange_n(&HEAP_PROFILE.lock_, 1, __ATOMIC_ACQUIRE)) {
+  }
+}
+static void Unlock_HeapProfile(void) {
+  __atomic_store_n(&HEAP_PROFILE.lock_, 0, __ATOMIC_RELEASE);
+}
+
+// -ln(u) for u uniform in (0, 1], without libm: exponent plus a polynomial for log2 of the mantissa. Good to about
+// 1%, plenty for spacing samples.
+static double neg_log_uniform_(uint64_t random) {
+  double u = ((random >> 11) + 1) * (1.0 / 9007199254740992.0);
+  union {
+      double   value;
+      uint64_t bits;
+  } parts      = {u};
+  int exponent = (int)((parts.bits >> 52) & 0x7FF) - 1023;
+  parts.bits   = (parts.bits & 0x000FFFFFFFFFFFFFull) | 0x3FF0000000000000ull;
+  double m     = parts.value - 1.0;
+  double log2m = m * (1.4425449 + m * (-0.7181452 + m * 0.2750314));
+  return -(exponent + log2m) * 0.6931471805599453;
+}
+static int64_t Next_ProfileCountdown(void) {
+  if (PROFILE_RANDOM == 0) {
+    PROFILE_RANDOM = ((uintptr_t)&PROFILE_RANDOM ^ (uint64_t)getpid() << 32) | 1;
+  }
+  PROFILE_RANDOM ^= PROFILE_RANDOM << 13;
+  PROFILE_RANDOM ^= PROFILE_RANDOM >> 7;
+  PROFILE_RANDOM ^= PROFILE_RANDOM << 17;
+  return (int64_t)(neg_log_uniform_(PROFILE_RANDOM) * ABERLLOC_PROFILE_INTERVAL) + 1;
+}
+
+static void Init_HeapProfile(void) {
+  if (HEAP_PROFILE.initialised_) {
+    return;
+  }
+  for (uint32_t i = 0; i < PROFILE_SAMPLES; i++) {
+    HEAP_PROFILE.samples_[i].below_ = i + 1 < PROFILE_SAMPLES ? i + 1 : PROFILE_NONE;
+  }
+  for (size_t i = 0; i < PROFILE_ARENAS; i++) {
+    HEAP_PROFILE.arenas_[i].top_ = PROFILE_NONE;
+  }
+  HEAP_PROFILE.free_sample_ = 0;
+  HEAP_PROFILE.initialised_ = TRUE;
+}
+
+static uint64_t hash_pointer_(const void* pointer) {
+  return ((uintptr_t)pointer >> 3) * 0x9E3779B97F4A7C15ull;
+}
+
+// Slot of the arena, inserted when asked. NULL when the table is full.
+// Entries are never emptied, an arena without samples in use gives its slot up to the next insert probing through it.
+static ProfileArena* Find_ProfileArena(const void* arena, int insert) {
+  size_t        index    = hash_pointer_(arena) >> 54;
+  ProfileArena* reusable = NULL;
+  for (size_t probe = 0; probe < PROFILE_ARENAS; probe++) {
+    ProfileArena* entry = &HEAP_PROFILE.arenas_[(index + probe) & (PROFILE_ARENAS - 1)];
+    if (entry->arena_ == arena) {
+      return entry;
+    }
+    if (entry->arena_ == NULL) {
+      reusable = reusable != NULL ? reusable : entry;
+      break;
+    }
+    if (reusable == NULL && entry->top_ == PROFILE_NONE) {
+      reusable = entry;
+    }
+  }
+  if (!insert || reusable == NULL) {
+    return NULL;
+  }
+  reusable->arena_ = arena;
+  reusable->top_   = PROFILE_NONE;
+  return reusable;
+}
+
+static uint32_t Find_ProfileStack(const void* arena, void** frames, int depth) {
+  uint64_t hash = hash_pointer_(arena);
+  for (int i = 0; i < depth; i++) {
+    hash = (hash ^ (uintptr_t)frames[i]) * 0x100000001B3ull;
+  }
+  size_t index = hash >> 40;
+  for (size_t probe = 0; probe < PROFILE_STACKS; probe++) {
+    uint32_t      slot  = (index + probe) & (PROFILE_STACKS - 1);
+    ProfileStack* stack = &HEAP_PROFILE.stacks_[slot];
+    if (stack->arena_ == NULL) {
+      stack->arena_ = arena;
+      stack->depth_ = depth;
+      memcpy(stack->frames_, frames, depth * sizeof(void*));
+      HEAP_PROFILE.stack_count_++;
+      return slot;
+    }
+    if (stack->arena_ == arena && stack->depth_ == depth && memcmp(stack->frames_, frames, depth * sizeof(void*)) == 0) {
+      return slot;
+    }
+  }
+  return PROFILE_NONE;
+}
+
+int Dump_HeapProfile(const char* path);
+
+// The stack is attributed to arena, the sample is released by pops of owner: the arena itself or a large block
+__attribute__((noinline)) static void Record_HeapProfile(const void* arena, const void* owner_key, uint64_t position, size_t bytes) {
+  if (PROFILE_RANDOM == 0) {
+    // First push of the thread, the countdown starts at 0: draw the first interval rather than sample it every time
+    PROFILE_COUNTDOWN += Next_ProfileCountdown();
+    if (PROFILE_COUNTDOWN >= 0) {
+      return;
+    }
+  }
+  PROFILE_COUNTDOWN = Next_ProfileCountdown();
+  if (PROFILE_SUSPENDED) {
+    return;
+  }
+  void* frames[ABERLLOC_PROFILE_DEPTH + 2];
+  int   depth = backtrace(frames, ABERLLOC_PROFILE_DEPTH + 2);
+  // Drop this function and the arena push that called it
+  depth = depth > 2 ? depth - 2 : 0;
+  Lock_HeapProfile();
+  Init_HeapProfile();
+  uint32_t stack_index = Find_ProfileStack(arena, frames + 2, depth);
+  if (stack_index == PROFILE_NONE) {
+    HEAP_PROFILE.dropped_++;
+    Unlock_HeapProfile();
+    return;
+  }
+  ProfileStack* stack = &HEAP_PROFILE.stacks_[stack_index];
+  stack->alloc_count_++;
+  stack->alloc_bytes_ += bytes;
+  ProfileArena* owner = Find_ProfileArena(owner_key, TRUE);
+  if (owner != NULL && HEAP_PROFILE.free_sample_ != PROFILE_NONE) {
+    uint32_t       index    = HEAP_PROFILE.free_sample_;
+    ProfileSample* sample   = &HEAP_PROFILE.samples_[index];
+    HEAP_PROFILE.free_sample_ = sample->below_;
+    sample->position_       = position;
+    sample->bytes_          = bytes;
+    sample->stack_          = stack_index;
+    sample->below_          = owner->top_;
+    owner->top_             = index;
+    stack->inuse_count_++;
+    stack->inuse_bytes_ += bytes;
+    __atomic_store_n(&HEAP_PROFILE.live_, HEAP_PROFILE.live_ + 1, __ATOMIC_RELAXED);
+  } else {
+    HEAP_PROFILE.dropped_++;
+  }
+  int dump = HEAP_PROFILE.dump_requested_;
+  HEAP_PROFILE.dump_requested_ = FALSE;
+  Unlock_HeapProfile();
+  if (dump) {
+    Dump_HeapProfile(HEAP_PROFILE.signal_path_);
+  }
+}
+
+// Releases the samples of the arena at or above position
+static void Pop_HeapProfile(const void* arena, uint64_t position) {
+  Lock_HeapProfile();
+  ProfileArena* owner = Find_ProfileArena(arena, FALSE);
+  while (owner != NULL && owner->top_ != PROFILE_NONE && HEAP_PROFILE.samples_[owner->top_].position_ >= position) {
+    uint32_t       index  = owner->top_;
+    ProfileSample* sample = &HEAP_PROFILE.samples_[index];
+    ProfileStack*  stack  = &HEAP_PROFILE.stacks_[sample->stack_];
+    stack->inuse_count_--;
+    stack->inuse_bytes_ -= sample->bytes_;
+    owner->top_               = sample->below_;
+    sample->below_            = HEAP_PROFILE.free_sample_;
+    HEAP_PROFILE.free_sample_ = index;
+    __atomic_store_n(&HEAP_PROFILE.live_, HEAP_PROFILE.live_ - 1, __ATOMIC_RELAXED);
+  }
+  Unlock_HeapProfile();
+}
+
+// Moves the samples of a scratch space on top of its parent's, they now belong to the parent.
+// The stacks keep the scratch as their arena, it was the one pushed on.
+static void Merge_HeapProfile(const void* scratch, const void* parent, uint64_t base_position) {
+  Lock_HeapProfile();
+  ProfileArena* from = Find_ProfileArena(scratch, FALSE);
+  ProfileArena* to   = from != NULL && from->top_ != PROFILE_NONE ? Find_ProfileArena(parent, TRUE) : NULL;
+  if (to != NULL) {
+    uint32_t bottom = from->top_;
+    HEAP_PROFILE.samples_[bottom].position_ += base_position;
+    while (HEAP_PROFILE.samples_[bottom].below_ != PROFILE_NONE) {
+      bottom = HEAP_PROFILE.samples_[bottom].below_;
+      HEAP_PROFILE.samples_[bottom].position_ += base_position;
+    }
+    HEAP_PROFILE.samples_[bottom].below_ = to->top_;
+    to->top_                             = from->top_;
+    from->top_                           = PROFILE_NONE;
+  }
+  Unlock_HeapProfile();
+  if (from != NULL && to == NULL) {
+    // No room for the parent, the samples can't be tracked any further
+    Pop_HeapProfile(scratch, 0);
+  }
+}
+
+// Legacy pprof heap profile (heap_v2), followed by the mappings pprof needs to symbolize.
+// pprof unsamples the counts with the interval from the header.
+int Dump_HeapProfile(const char* path) {
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+  Lock_HeapProfile();
+  uint64_t totals[4] = {0, 0, 0, 0};
+  for (size_t i = 0; i < PROFILE_STACKS; i++) {
+    ProfileStack* stack = &HEAP_PROFILE.stacks_[i];
+    totals[0] += stack->inuse_count_;
+    totals[1] += stack->inuse_bytes_;
+    totals[2] += stack->alloc_count_;
+    totals[3] += stack->alloc_bytes_;
+  }
+  fprintf(file, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%llu\n", (unsigned long long)totals[0], (unsigned long long)totals[1],
+          (unsigned long long)totals[2], (unsigned long long)totals[3], (unsigned long long)ABERLLOC_PROFILE_INTERVAL);
+  for (size_t i = 0; i < PROFILE_STACKS; i++) {
+    ProfileStack* stack = &HEAP_PROFILE.stacks_[i];
+    if (stack->arena_ == NULL || stack->alloc_count_ == 0) {
+      continue;
+    }
+    fprintf(file, "%llu: %llu [%llu: %llu] @", (unsigned long long)stack->inuse_count_, (unsigned long long)stack->inuse_bytes_,
+            (unsigned long long)stack->alloc_count_, (unsigned long long)stack->alloc_bytes_);
+    for (int frame = 0; frame < stack->depth_; frame++) {
+      fprintf(file, " %p", stack->frames_[frame]);
+    }
+    fprintf(file, "\n");
+  }
+  Unlock_HeapProfile();
+  fprintf(file, "\nMAPPED_LIBRARIES:\n");
+  FILE* maps = fopen("/proc/self/maps", "r");
+  if (maps != NULL) {
+    char   buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), maps)) > 0) {
+      fwrite(buffer, 1, read, file);
+    }
+    fclose(maps);
+  }
+  int result = ferror(file) ? ERROR_INVALID_PARAMS : SUCCESS;
+  fclose(file);
+  return result;
+}
+
+// Estimated in-use and allocated bytes per arena. A sample stands for at least one interval of bytes.
+int Summary_HeapProfile(const char* path) {
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+  Lock_HeapProfile();
+  fprintf(file, "%-18s %14s %14s %8s  %s\n", "arena", "inuse bytes", "alloc bytes", "stacks", "top call site");
+  for (size_t i = 0; i < PROFILE_STACKS; i++) {
+    const void* arena = HEAP_PROFILE.stacks_[i].arena_;
+    int         seen  = FALSE;
+    for (size_t j = 0; j < i && !seen; j++) {
+      seen = HEAP_PROFILE.stacks_[j].arena_ == arena;
+    }
+    if (arena == NULL || seen) {
+      continue;
+    }
+    uint64_t inuse = 0, alloc = 0, stacks = 0, top_alloc = 0;
+    void*    top_site = NULL;
+    for (size_t j = i; j < PROFILE_STACKS; j++) {
+      ProfileStack* stack = &HEAP_PROFILE.stacks_[j];
+      if (stack->arena_ != arena) {
+        continue;
+      }
+      uint64_t per_sample = stack->alloc_count_ ? stack->alloc_bytes_ / stack->alloc_count_ : 0;
+      per_sample          = per_sample > ABERLLOC_PROFILE_INTERVAL ? per_sample : ABERLLOC_PROFILE_INTERVAL;
+      inuse += stack->inuse_count_ * per_sample;
+      alloc += stack->alloc_count_ * per_sample;
+      stacks++;
+      if (stack->alloc_count_ * per_sample > top_alloc && stack->depth_ > 0) {
+        top_alloc = stack->alloc_count_ * per_sample;
+        top_site  = stack->frames_[0];
+      }
+    }
+    fprintf(file, "%-18p %14llu %14llu %8llu  %p\n", arena, (unsigned long long)inuse, (unsigned long long)alloc, (unsigned long long)stacks,
+            top_site);
+  }
+  fprintf(file, "dropped samples: %llu\n", (unsigned long long)HEAP_PROFILE.dropped_);
+  Unlock_HeapProfile();
+  fclose(file);
+  return SUCCESS;
+}
+
+// The handler only raises a flag, the dump is written by the next sampled push, outside of the signal context
+static void Handler_HeapProfile(int signal_number) {
+  (void)signal_number;
+  HEAP_PROFILE.dump_requested_ = TRUE;
+}
+int InstallSignal_HeapProfile(int signal_number, const char* path) {
+  HEAP_PROFILE.signal_path_ = path;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = Handler_HeapProfile;
+  sigemptyset(&action.sa_mask);
+  return sigaction(signal_number, &action, NULL) == 0 ? SUCCESS : ERROR_INVALID_PARAMS;
+}
+
+#define PROFILE_PUSH(arena, position, bytes)                       \
+  do {                                                             \
+    if ((PROFILE_COUNTDOWN -= (int64_t)(bytes)) < 0) {             \
+      Record_HeapProfile((arena), (arena), (position), (bytes));   \
+    }                                                              \
+  } while (0)
+// Pushes served by a large block, arena pops leave the sample alone and freeing the block releases it
+#define PROFILE_PUSH_BLOCK(arena, block, bytes)                    \
+  do {                                                             \
+    if ((PROFILE_COUNTDOWN -= (int64_t)(bytes)) < 0) {             \
+      Record_HeapProfile((arena), (block), 0, (bytes));            \
+    }                                                              \
+  } while (0)
+#define PROFILE_POP(arena, position)                                \
+  do {                                                              \
+    if (__atomic_load_n(&HEAP_PROFILE.live_, __ATOMIC_RELAXED)) {   \
+      Pop_HeapProfile((arena), (position));                         \
+    }                                                               \
+  } while (0)
+#define PROFILE_MERGE(scratch, parent, base_position)               \
+  do {                                                              \
+    if (__atomic_load_n(&HEAP_PROFILE.live_, __ATOMIC_RELAXED)) {   \
+      Merge_HeapProfile((scratch), (parent), (base_position));      \
+    }                                                               \
+  } while (0)
+// Around pushes that are accounted for by the pushes made inside them (scratch spaces)
+#define PROFILE_SUSPEND() (PROFILE_SUSPENDED++)
+#define PROFILE_RESUME()  (PROFILE_SUSPENDED--)
+#else
+#define PROFILE_PUSH(arena, position, bytes)          ((void)0)
+#define PROFILE_PUSH_BLOCK(arena, block, bytes)       ((void)0)
+#define PROFILE_POP(arena, position)                  ((void)0)
+#define PROFILE_MERGE(scratch, parent, base_position) ((void)0)
+#define PROFILE_SUSPEND()                             ((void)0)
+#define PROFILE_RESUME()                              ((void)0)
+#endif
+
+#endif
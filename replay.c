@@ -0,0 +1,458 @@
+// Replays an allocation trace recorded with ABERLLOC_TRACE (see trace.h) against another arena configuration and
+// reports the time, the OS calls and the peak RSS it took. Linux only.
+//   gcc -O2 replay.c -o replay
+//   ./replay trace.bin [--arena virtual|chained] [--reserve BYTES] [--remap 0|1]
+//                      [--policy geometric|linear|fixed|huge|adaptive] [--step BYTES] [--no-touch]
+// Virtual and chained arenas from the trace are replayed as --arena (default: as traced), static arenas and scratch
+// spaces stay static. Positions are translated through the (traced, replayed) position after every push, so popping
+// to a traced position pops to the matching replayed one even when alignment or chunking differ.
+#ifndef ABERLLOC_STATS
+#define ABERLLOC_STATS
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "chained_arena.h"
+#include "policy.h"
+#include "trace.h"
+#include "virtual_arena.h"
+
+#define REPLAY_MAX_ARENAS  16384  // Power of two
+#define REPLAY_PAIRS_SIZE  ((size_t)4 * 1024 * 1024 * 1024)
+#define CHAINED_POS_SHIFT  48
+
+typedef struct PosPair {
+    uint64_t traced_;
+    uint64_t replayed_;
+} PosPair;
+
+typedef struct ReplaySlot {
+    uint64_t id_;  // Traced arena address, 0 if the slot was never used
+    int      kind_;
+    int      live_;
+    union {
+        StaticArena  static_;
+        VirtualArena virtual_;
+        ChainedArena chained_;
+    } arena_;
+    uint8_t*     last_push_;
+    VirtualArena pairs_;  // PosPair stack
+    size_t       pair_count_;
+} ReplaySlot;
+
+typedef struct ReplayConfig {
+    int         kind_;     // 0 keeps the traced kind
+    size_t      reserve_;  // 0 keeps the traced size
+    int         remap_;    // -1 keeps the traced flag
+    ArenaPolicy policy_;
+    int         touch_;
+} ReplayConfig;
+
+static ReplaySlot SLOTS[REPLAY_MAX_ARENAS];
+static size_t     SKIPPED = 0;
+
+static ReplaySlot* Find_ReplaySlot(uint64_t id, int insert) {
+  size_t index = (id >> 4) * 0x9E3779B97F4A7C15ull >> 50 & (REPLAY_MAX_ARENAS - 1);
+  for (size_t probe = 0; probe < REPLAY_MAX_ARENAS; probe++) {
+    ReplaySlot* slot = &SLOTS[(index + probe) & (REPLAY_MAX_ARENAS - 1)];
+    if (slot->id_ == id) {
+      return slot;
+    }
+    if (slot->id_ == 0) {
+      if (!insert) {
+        return NULL;
+      }
+      slot->id_ = id;
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+static uint64_t Pos_ReplaySlot(ReplaySlot* slot) {
+  switch (slot->kind_) {
+    case TRACE_VIRTUAL:
+      return slot->arena_.virtual_.position_;
+    case TRACE_CHAINED:
+      return ((uint64_t)slot->arena_.chained_.chunk_->index_ << CHAINED_POS_SHIFT) | slot->arena_.chained_.position_;
+    default:
+      return slot->arena_.static_.position_;
+  }
+}
+
+// The position stacks are replay bookkeeping, the OS calls they make are taken back out of the counters
+static void PushPair_ReplaySlot(ReplaySlot* slot, uint64_t traced) {
+  OsStats  saved  = OS_STATS;
+  PosPair* pair   = (PosPair*)PushNoZero_VirtualArena(&slot->pairs_, sizeof(PosPair));
+  pair->traced_   = traced;
+  pair->replayed_ = Pos_ReplaySlot(slot);
+  slot->pair_count_++;
+  OS_STATS = saved;
+}
+
+static void DropPairs_ReplaySlot(ReplaySlot* slot, uint64_t traced) {
+  OsStats  saved = OS_STATS;
+  PosPair* pairs = (PosPair*)slot->pairs_.memory_;
+  while (slot->pair_count_ > 0 && pairs[slot->pair_count_ - 1].traced_ > traced) {
+    slot->pair_count_--;
+  }
+  PopTo_VirtualArena(&slot->pairs_, slot->pair_count_ * sizeof(PosPair));
+  OS_STATS = saved;
+}
+
+static uint64_t MapPos_ReplaySlot(ReplaySlot* slot, uint64_t traced) {
+  DropPairs_ReplaySlot(slot, traced);
+  if (slot->pair_count_ == 0) {
+    return 0;
+  }
+  PosPair* top = (PosPair*)slot->pairs_.memory_ + slot->pair_count_ - 1;
+  // Positions between two pushes (a saved position before an aligner) keep their distance to the last push
+  if (traced >> CHAINED_POS_SHIFT == top->traced_ >> CHAINED_POS_SHIFT) {
+    return top->replayed_ + (traced - top->traced_);
+  }
+  return top->replayed_;
+}
+
+static void PopTo_ReplaySlot(ReplaySlot* slot, uint64_t position) {
+  switch (slot->kind_) {
+    case TRACE_VIRTUAL:
+      PopTo_VirtualArena(&slot->arena_.virtual_, position);
+      break;
+    case TRACE_CHAINED: {
+      ChainedArenaPos pos = {position >> CHAINED_POS_SHIFT, position & (((uint64_t)1 << CHAINED_POS_SHIFT) - 1)};
+      PopTo_ChainedArena(&slot->arena_.chained_, pos);
+      break;
+    }
+    default:
+      PopTo_StaticArena(&slot->arena_.static_, position);
+  }
+}
+
+static int InitPairs_ReplaySlot(ReplaySlot* slot) {
+  OsStats saved  = OS_STATS;
+  int     result = Init_VirtualArena(&slot->pairs_, REPLAY_PAIRS_SIZE, 0, FALSE);
+  OS_STATS       = saved;
+  return result;
+}
+
+static void Release_ReplaySlot(ReplaySlot* slot) {
+  OsStats saved = OS_STATS;
+  Destroy_VirtualArena(&slot->pairs_);
+  OS_STATS = saved;
+  slot->live_       = FALSE;
+  slot->pair_count_ = 0;
+}
+
+static int Init_ReplaySlot(ReplaySlot* slot, TraceEvent* event, ReplayConfig* config) {
+  if (slot->live_) {
+    // Destroy was not traced (or the ring wrapped), drop the old one
+    Release_ReplaySlot(slot);
+  }
+  slot->kind_ = event->kind_;
+  if (event->kind_ != TRACE_STATIC && config->kind_ != 0) {
+    slot->kind_ = config->kind_;
+  }
+  size_t size  = config->reserve_ && event->kind_ != TRACE_STATIC ? config->reserve_ : event->value_;
+  int    remap = config->remap_ >= 0 ? config->remap_ : event->flags_;
+  int    result;
+  switch (slot->kind_) {
+    case TRACE_VIRTUAL:
+      result = Init_VirtualArena(&slot->arena_.virtual_, size, event->position_, remap);
+      if (result == SUCCESS) {
+        SetPolicy_VirtualArena(&slot->arena_.virtual_, &config->policy_);
+      }
+      break;
+    case TRACE_CHAINED:
+      result = Init_ChainedArena(&slot->arena_.chained_, size, event->position_);
+      if (result == SUCCESS) {
+        SetPolicy_ChainedArena(&slot->arena_.chained_, &config->policy_);
+      }
+      break;
+    default:
+      result = Init_StaticArena(&slot->arena_.static_, size, event->position_);
+  }
+  if (result != SUCCESS || InitPairs_ReplaySlot(slot) != SUCCESS) {
+    return ERROR_OS_MEMORY;
+  }
+  slot->live_       = TRUE;
+  slot->pair_count_ = 0;
+  slot->last_push_  = NULL;
+  return SUCCESS;
+}
+
+static void Push_ReplaySlot(ReplaySlot* slot, TraceEvent* event, ReplayConfig* config) {
+  uint8_t* mem   = NULL;
+  int      zero  = event->op_ == TRACE_PUSH;
+  int      large = event->op_ == TRACE_PUSH_LARGE_BLOCK;
+  switch (slot->kind_) {
+    case TRACE_VIRTUAL:
+      mem = large  ? PushLargeBlock_VirtualArena(&slot->arena_.virtual_, event->value_)
+            : zero ? Push_VirtualArena(&slot->arena_.virtual_, event->value_)
+                   : PushNoZero_VirtualArena(&slot->arena_.virtual_, event->value_);
+      break;
+    case TRACE_CHAINED:
+      // Chained arenas have no large blocks of their own, they just grow
+      mem = zero ? Push_ChainedArena(&slot->arena_.chained_, event->value_) : PushNoZero_ChainedArena(&slot->arena_.chained_, event->value_);
+      break;
+    default:
+      mem = large  ? PushLargeBlock_StaticArena(&slot->arena_.static_, event->value_)
+            : zero ? Push_StaticArena(&slot->arena_.static_, event->value_)
+                   : PushNoZero_StaticArena(&slot->arena_.static_, event->value_);
+  }
+  if (mem == NULL) {
+    fprintf(stderr, "Push of %llu bytes failed during replay\n", (unsigned long long)event->value_);
+    return;
+  }
+  if (!zero && config->touch_) {
+    // The traced program wrote what it allocated, without this RSS would only count zeroing pushes
+    memset(mem, 1, event->value_);
+  }
+  slot->last_push_ = mem;
+  if (!large) {
+    PushPair_ReplaySlot(slot, event->position_);
+  }
+}
+
+static void Scratch_ReplaySlot(ReplaySlot* slot, TraceEvent* event) {
+  ReplaySlot* parent = Find_ReplaySlot(event->value_, FALSE);
+  if (parent == NULL || !parent->live_ || parent->last_push_ == NULL) {
+    SKIPPED++;
+    return;
+  }
+  if (slot->live_) {
+    Release_ReplaySlot(slot);
+  }
+  if (InitPairs_ReplaySlot(slot) != SUCCESS) {
+    return;
+  }
+  // The parent push was replayed already, the scratch is built on top of it the same way InitScratch_* does
+  StaticArena* scratch  = &slot->arena_.static_;
+  scratch->memory_      = parent->last_push_;
+  scratch->total_size_  = event->position_;
+  scratch->position_    = 0;
+  scratch->color_       = 0;
+  scratch->blocks_      = NULL;
+  scratch->blocks_tail_ = NULL;
+  scratch->auto_align_  = event->flags_ != 0;
+  scratch->alignment_   = event->flags_ != 0 ? (size_t)1 << event->flags_ : WORD_SIZE;
+  slot->kind_           = TRACE_STATIC;
+  slot->live_           = TRUE;
+  slot->pair_count_     = 0;
+  slot->last_push_      = NULL;
+}
+
+static void EndScratch_ReplaySlot(ReplaySlot* slot, TraceEvent* event) {
+  ReplaySlot* parent = Find_ReplaySlot(event->value_, FALSE);
+  if (parent == NULL || !parent->live_) {
+    SKIPPED++;
+    return;
+  }
+  StaticArena* scratch = &slot->arena_.static_;
+  int          merge   = event->op_ == TRACE_MERGE_SCRATCH;
+  switch (parent->kind_) {
+    case TRACE_VIRTUAL:
+      merge ? MergeScratch_VirtualArena(scratch, &parent->arena_.virtual_) : DestroyScratch_VirtualArena(scratch, &parent->arena_.virtual_);
+      break;
+    case TRACE_CHAINED:
+      merge ? MergeScratch_ChainedArena(scratch, &parent->arena_.chained_) : DestroyScratch_ChainedArena(scratch, &parent->arena_.chained_);
+      break;
+    default:
+      merge ? MergeScratch_StaticArena(scratch, &parent->arena_.static_) : DestroyScratch_StaticArena(scratch, &parent->arena_.static_);
+  }
+  DropPairs_ReplaySlot(parent, event->position_);
+  PushPair_ReplaySlot(parent, event->position_);
+  Release_ReplaySlot(slot);
+}
+
+static void Replay(TraceEvent* event, ReplayConfig* config) {
+  ReplaySlot* slot = Find_ReplaySlot(event->arena_, event->op_ == TRACE_INIT || event->op_ == TRACE_INIT_SCRATCH);
+  if (slot == NULL) {
+    SKIPPED++;
+    return;
+  }
+  if (event->op_ == TRACE_INIT) {
+    if (Init_ReplaySlot(slot, event, config) != SUCCESS) {
+      fprintf(stderr, "Arena initialisation failed during replay\n");
+    }
+    return;
+  }
+  if (event->op_ == TRACE_INIT_SCRATCH) {
+    Scratch_ReplaySlot(slot, event);
+    return;
+  }
+  if (!slot->live_) {
+    SKIPPED++;
+    return;
+  }
+  switch (event->op_) {
+    case TRACE_DESTROY:
+      if (slot->kind_ == TRACE_VIRTUAL) {
+        Destroy_VirtualArena(&slot->arena_.virtual_);
+      } else if (slot->kind_ == TRACE_CHAINED) {
+        Destroy_ChainedArena(&slot->arena_.chained_);
+      } else {
+        Destroy_StaticArena(&slot->arena_.static_);
+      }
+      Release_ReplaySlot(slot);
+      break;
+    case TRACE_PUSH:
+    case TRACE_PUSH_NO_ZERO:
+    case TRACE_PUSH_LARGE_BLOCK:
+      Push_ReplaySlot(slot, event, config);
+      break;
+    case TRACE_POP:
+    case TRACE_POP_TO:
+      PopTo_ReplaySlot(slot, MapPos_ReplaySlot(slot, event->position_));
+      break;
+    case TRACE_CLEAR:
+      if (slot->kind_ == TRACE_VIRTUAL) {
+        Clear_VirtualArena(&slot->arena_.virtual_);
+      } else if (slot->kind_ == TRACE_CHAINED) {
+        Clear_ChainedArena(&slot->arena_.chained_);
+      } else {
+        Clear_StaticArena(&slot->arena_.static_);
+      }
+      DropPairs_ReplaySlot(slot, 0);
+      break;
+    case TRACE_POP_LARGE_BLOCK:
+      if (slot->kind_ == TRACE_VIRTUAL) {
+        PopLargeBlock_VirtualArena(&slot->arena_.virtual_);
+      } else if (slot->kind_ == TRACE_STATIC) {
+        PopLargeBlock_StaticArena(&slot->arena_.static_);
+      }
+      break;
+    case TRACE_MERGE_SCRATCH:
+    case TRACE_DESTROY_SCRATCH:
+      EndScratch_ReplaySlot(slot, event);
+      break;
+    default:
+      SKIPPED++;
+  }
+}
+
+static size_t ReadStatusKb(const char* field) {
+  FILE* file = fopen("/proc/self/status", "r");
+  char  line[256];
+  size_t value = 0;
+  size_t length = strlen(field);
+  while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+    if (strncmp(line, field, length) == 0) {
+      value = strtoull(line + length + 1, NULL, 10);
+      break;
+    }
+  }
+  if (file != NULL) {
+    fclose(file);
+  }
+  return value;
+}
+
+static int ParsePolicy(ReplayConfig* config, const char* name, size_t step) {
+  if (strcmp(name, "geometric") == 0) {
+    return Init_GeometricPolicy(&config->policy_);
+  }
+  if (strcmp(name, "linear") == 0) {
+    return Init_LinearPolicy(&config->policy_, step);
+  }
+  if (strcmp(name, "fixed") == 0) {
+    return Init_FixedStepPolicy(&config->policy_, step);
+  }
+  if (strcmp(name, "huge") == 0) {
+    return Init_HugePagePolicy(&config->policy_);
+  }
+  if (strcmp(name, "adaptive") == 0) {
+    return Init_AdaptivePolicy(&config->policy_);
+  }
+  return ERROR_INVALID_PARAMS;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "Usage: %s trace.bin [--arena virtual|chained] [--reserve BYTES] [--remap 0|1]\n"
+            "       [--policy geometric|linear|fixed|huge|adaptive] [--step BYTES] [--no-touch]\n",
+            argv[0]);
+    return 1;
+  }
+  ReplayConfig config = {0, 0, -1, {0}, TRUE};
+  const char*  policy = "geometric";
+  size_t       step   = (size_t)1024 * 1024;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--arena") == 0 && i + 1 < argc) {
+      i++;
+      config.kind_ = strcmp(argv[i], "chained") == 0 ? TRACE_CHAINED : TRACE_VIRTUAL;
+    } else if (strcmp(argv[i], "--reserve") == 0 && i + 1 < argc) {
+      config.reserve_ = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--remap") == 0 && i + 1 < argc) {
+      config.remap_ = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+      policy = argv[++i];
+    } else if (strcmp(argv[i], "--step") == 0 && i + 1 < argc) {
+      step = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--no-touch") == 0) {
+      config.touch_ = FALSE;
+    } else {
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (ParsePolicy(&config, policy, step) != SUCCESS) {
+    fprintf(stderr, "Unknown policy %s\n", policy);
+    return 1;
+  }
+
+  FILE* file = fopen(argv[1], "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Cannot open %s\n", argv[1]);
+    return 1;
+  }
+  TraceFileHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || header.magic_ != TRACE_MAGIC || header.version_ != TRACE_VERSION) {
+    fprintf(stderr, "%s is not a trace file\n", argv[1]);
+    fclose(file);
+    return 1;
+  }
+  StaticArena events;
+  if (Init_StaticArena(&events, align_2pow(header.event_count_ * sizeof(TraceEvent) + 1, _getPageSize()), 0) != SUCCESS) {
+    fprintf(stderr, "Cannot allocate the trace\n");
+    fclose(file);
+    return 1;
+  }
+  TraceEvent* trace = (TraceEvent*)PushNoZero_StaticArena(&events, header.event_count_ * sizeof(TraceEvent));
+  if (fread(trace, sizeof(TraceEvent), header.event_count_, file) != header.event_count_) {
+    fprintf(stderr, "Truncated trace\n");
+    fclose(file);
+    return 1;
+  }
+  fclose(file);
+
+  // Reset the high-water mark so the trace buffer does not count as peak
+  FILE* clear_refs = fopen("/proc/self/clear_refs", "w");
+  if (clear_refs != NULL) {
+    fputs("5", clear_refs);
+    fclose(clear_refs);
+  }
+  size_t          rss_before = ReadStatusKb("VmRSS:");
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint64_t i = 0; i < header.event_count_; i++) {
+    Replay(&trace[i], &config);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  size_t rss_peak = ReadStatusKb("VmHWM:");
+
+  double  elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+  OsStats stats      = OS_STATS;
+  size_t  syscalls   = stats.mappings_ + stats.commits_ + stats.uncommits_ + stats.advises_ + stats.protects_ + stats.frees_;
+  printf("events      %llu (%zu skipped)\n", (unsigned long long)header.event_count_, SKIPPED);
+  printf("time        %.3f ms (%.1f ns/event)\n", elapsed_ms, elapsed_ms * 1e6 / (header.event_count_ ? header.event_count_ : 1));
+  printf("mappings    %zu\n", stats.mappings_);
+  printf("commits     %zu\n", stats.commits_);
+  printf("uncommits   %zu\n", stats.uncommits_);
+  printf("advises     %zu\n", stats.advises_);
+  printf("protects    %zu\n", stats.protects_);
+  printf("frees       %zu\n", stats.frees_);
+  printf("syscalls    %zu\n", syscalls);
+  printf("peak RSS    %zu kB (%zu kB above the start of the replay)\n", rss_peak, rss_peak > rss_before ? rss_peak - rss_before : 0);
+  return 0;
+}
@@ -0,0 +1,201 @@
+#ifndef _SNAPSHOT_ARENA_HEADER
+#define _SNAPSHOT_ARENA_HEADER
+#include <stdint.h>
+#include <stdlib.h>
+#include "./utils.h"
+#include "./virtual_arena.h"
+#ifndef __linux__
+#error "Snapshot arenas need memfd and /proc/self/pagemap, Linux only."
+#endif
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+// Checkpoint and rollback of a whole virtual arena at the cost of the pages touched, not the arena size.
+// The arena memory is a shared mapping of a memfd. A checkpoint remaps it copy-on-write (MAP_PRIVATE), so the file
+// keeps the checkpointed state while every page written afterwards gets a private copy. Rollback drops the private
+// copies and the pages fault back in from the file. The next checkpoint, or a release, writes the private pages found
+// in /proc/self/pagemap back into the file.
+// Push and pop through the VirtualArena functions on arena_. Large blocks are not part of the snapshot, a rollback
+// frees the ones pushed after the checkpoint. The arena never remaps.
+// Single-threaded
+typedef struct SnapshotArena {
+    VirtualArena   arena_;
+    int            memfd_;
+    int            pagemap_;       // -1 if unreadable, every page below the position then counts as written
+    int            active_;        // A checkpoint is taken, the mapping is private
+    uintptr_t      position_;      // Arena position at the checkpoint
+    LargeMemBlock* blocks_;        // Top large block at the checkpoint
+    size_t         dirty_pages_;   // Written back by the last checkpoint or release
+} SnapshotArena;
+
+#define PAGEMAP_PRESENT ((uint64_t)1 << 63)
+#define PAGEMAP_SWAPPED ((uint64_t)1 << 62)
+#define PAGEMAP_FILE    ((uint64_t)1 << 61)  // Still the file page, or shared
+#define PAGEMAP_BATCH   512
+
+static int Map_SnapshotArena(SnapshotArena* snapshot, int flags) {
+  OS_STAT(mappings_);
+  VirtualArena* arena = &snapshot->arena_;
+  uint8_t*      mem   = (uint8_t*)mmap(arena->memory_, arena->total_size_, PROT_READ | PROT_WRITE, flags | MAP_FIXED | MAP_NORESERVE, snapshot->memfd_, 0);
+  return mem == arena->memory_ ? SUCCESS : ERROR_OS_MEMORY;
+}
+
+static inline int is_private_page_(uint64_t entry) {
+  return (entry & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED)) && !(entry & PAGEMAP_FILE);
+}
+
+// Copies the private pages below the position into the file, and releases the file pages above it
+static int WriteBack_SnapshotArena(SnapshotArena* snapshot) {
+  VirtualArena* arena = &snapshot->arena_;
+  size_t        page  = _getPageSize();
+  size_t        end   = align_2pow(arena->position_ < arena->total_size_ ? arena->position_ : arena->total_size_, page);
+  uint64_t      entries[PAGEMAP_BATCH];
+  snapshot->dirty_pages_ = 0;
+  for (size_t offset = 0; offset < end; offset += PAGEMAP_BATCH * page) {
+    size_t count = (end - offset) / page < PAGEMAP_BATCH ? (end - offset) / page : PAGEMAP_BATCH;
+    off_t  index = (off_t)(((uintptr_t)arena->memory_ + offset) / page * sizeof(uint64_t));
+    if (snapshot->pagemap_ < 0 || pread(snapshot->pagemap_, entries, count * sizeof(uint64_t), index) != (ssize_t)(count * sizeof(uint64_t))) {
+      for (size_t i = 0; i < count; i++) {
+        entries[i] = PAGEMAP_PRESENT;
+      }
+    }
+    for (size_t i = 0; i < count;) {
+      if (!is_private_page_(entries[i])) {
+        i++;
+        continue;
+      }
+      size_t run = i + 1;
+      while (run < count && is_private_page_(entries[run])) {
+        run++;
+      }
+      size_t from  = offset + i * page;
+      size_t bytes = (run - i) * page;
+      if (pwrite(snapshot->memfd_, arena->memory_ + from, bytes, (off_t)from) != (ssize_t)bytes) {
+        DEBUG_PRINT("Snapshot write back failed");
+        return ERROR_OS_MEMORY;
+      }
+      snapshot->dirty_pages_ += run - i;
+      i = run;
+    }
+  }
+  // FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, nothing above the position is worth keeping
+  if (end < arena->total_size_ && syscall(SYS_fallocate, snapshot->memfd_, 0x03, (off_t)end, (off_t)(arena->total_size_ - end)) != 0) {
+    DEBUG_PRINT("Releasing the snapshot tail failed, continuing");
+  }
+  return SUCCESS;
+}
+
+int Init_SnapshotArena(SnapshotArena* snapshot, size_t arena_size, size_t auto_align) {
+#ifdef DEBUG
+  if (snapshot == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  arena_size       = align_2pow(arena_size, _getPageSize());
+  snapshot->memfd_ = (int)syscall(SYS_memfd_create, "aberlloc-snapshot", 1u);  // MFD_CLOEXEC
+  if (snapshot->memfd_ < 0) {
+    return ERROR_OS_MEMORY;
+  }
+  if (ftruncate(snapshot->memfd_, (off_t)arena_size) != 0 || Init_VirtualArena(&snapshot->arena_, arena_size, auto_align, FALSE) != SUCCESS) {
+    close(snapshot->memfd_);
+    return ERROR_OS_MEMORY;
+  }
+  // The anonymous reservation is replaced in place by the file
+  if (Map_SnapshotArena(snapshot, MAP_SHARED) != SUCCESS) {
+    Destroy_VirtualArena(&snapshot->arena_);
+    close(snapshot->memfd_);
+    return ERROR_OS_MEMORY;
+  }
+  snapshot->pagemap_     = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  snapshot->active_      = FALSE;
+  snapshot->position_    = 0;
+  snapshot->blocks_      = NULL;
+  snapshot->dirty_pages_ = 0;
+  return SUCCESS;
+}
+
+int Destroy_SnapshotArena(SnapshotArena* snapshot) {
+#ifdef DEBUG
+  if (snapshot == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  Destroy_VirtualArena(&snapshot->arena_);
+  close(snapshot->memfd_);
+  if (snapshot->pagemap_ >= 0) {
+    close(snapshot->pagemap_);
+  }
+  snapshot->memfd_   = -1;
+  snapshot->pagemap_ = -1;
+  snapshot->active_  = FALSE;
+  snapshot->blocks_  = NULL;
+  return SUCCESS;
+}
+
+// Takes a checkpoint of the current state. If one is active, its changes are kept and the checkpoint moves here.
+int Checkpoint_SnapshotArena(SnapshotArena* snapshot) {
+#ifdef DEBUG
+  if (snapshot == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  if (snapshot->active_) {
+    if (WriteBack_SnapshotArena(snapshot) != SUCCESS) {
+      return ERROR_OS_MEMORY;
+    }
+  } else {
+    snapshot->dirty_pages_ = 0;
+  }
+  if (Map_SnapshotArena(snapshot, MAP_PRIVATE) != SUCCESS) {
+    return ERROR_OS_MEMORY;
+  }
+  snapshot->active_   = TRUE;
+  snapshot->position_ = snapshot->arena_.position_;
+  snapshot->blocks_   = snapshot->arena_.blocks_;
+  return SUCCESS;
+}
+
+// Restores the arena to the last checkpoint, which stays active for further rollbacks
+int Rollback_SnapshotArena(SnapshotArena* snapshot) {
+#ifdef DEBUG
+  if (snapshot == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  if (!snapshot->active_) {
+    return ERROR_INVALID_PARAMS;
+  }
+  VirtualArena* arena = &snapshot->arena_;
+  OS_STAT(uncommits_);
+  if (madvise(arena->memory_, arena->committed_size_ > arena->total_size_ ? arena->total_size_ : arena->committed_size_, MADV_DONTNEED) != 0) {
+    return ERROR_OS_MEMORY;
+  }
+  while (arena->blocks_ != NULL && arena->blocks_ != snapshot->blocks_) {
+    arena->blocks_ = Pop_LargeMemoryBlock(arena->blocks_);
+  }
+  arena->position_ = snapshot->position_;
+  GUARD_POP(arena, arena->position_);
+  PROFILE_POP(arena, arena->position_);
+  return SUCCESS;
+}
+
+// Keeps the changes made since the checkpoint and goes back to a plain shared mapping
+int Release_SnapshotArena(SnapshotArena* snapshot) {
+#ifdef DEBUG
+  if (snapshot == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  if (!snapshot->active_) {
+    return SUCCESS;
+  }
+  if (WriteBack_SnapshotArena(snapshot) != SUCCESS || Map_SnapshotArena(snapshot, MAP_SHARED) != SUCCESS) {
+    return ERROR_OS_MEMORY;
+  }
+  snapshot->active_ = FALSE;
+  snapshot->blocks_ = NULL;
+  return SUCCESS;
+}
+
+#endif
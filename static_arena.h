@@ -2,7 +2,10 @@
 #define _STATIC_ARENA_HEADER
 // #include <pthread.h>
 
+#include "./guard.h"
 #include "./memblock.h"
+#include "./profiler.h"
+#include "./trace.h"
 #include "./utils.h"
 #ifdef _WIN32
 #ifdef __GNUC__
@@ -25,23 +28,27 @@ typedef struct StaticArena {
     uintptr_t total_size_;  // Size
     // pthread_mutex_t __arena_mutex;
     int auto_align_;
-    int alignment_;
+    size_t alignment_;
     // StaticArena*    __parent;
     LargeMemBlock* blocks_;
+    LargeMemBlock* blocks_tail_;  // Oldest large block, merges splice the chain in O(1)
+    uintptr_t      color_;  // First position, the arena never pops below it. 0 unless built with ABERLLOC_CACHE_COLORING
 } StaticArena;
 
-int Init_StaticArena(StaticArena* arena, int arena_size, int auto_align) {
+int Init_StaticArena(StaticArena* arena, size_t arena_size, size_t auto_align) {
 #ifdef DEBUG
   if (arena == NULL || arena_size < _getPageSize()) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
-  arena->total_size_ = arena_size;
-  arena->position_   = 0;
-  arena->blocks_     = NULL;
+  arena->total_size_  = arena_size;
+  arena->color_       = NEXT_CACHE_COLOR();
+  arena->position_    = arena->color_;
+  arena->blocks_      = NULL;
+  arena->blocks_tail_ = NULL;
   // arena->__parent     = NULL;
-  int word_size = WORD_SIZE;
-  if (auto_align > word_size && __builtin_popcount(auto_align) == 1) {
+  size_t word_size = WORD_SIZE;
+  if (auto_align > word_size && __builtin_popcountll(auto_align) == 1) {
     arena->auto_align_ = TRUE;
     arena->alignment_  = auto_align;
   } else {
@@ -52,6 +59,7 @@ int Init_StaticArena(StaticArena* arena, int arena_size, int auto_align) {
   if (arena->memory_ == NULL) {
     return ERROR_OS_MEMORY;
   }
+  TRACE_EVENT(TRACE_INIT, TRACE_STATIC, arena, arena_size, auto_align);
   return SUCCESS;
 }
 int Destroy_StaticArena(StaticArena* arena) {
@@ -60,7 +68,12 @@ int Destroy_StaticArena(StaticArena* arena) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
+  TRACE_EVENT(TRACE_DESTROY, TRACE_STATIC, arena, 0, 0);
+  GUARD_POP(arena, 0);
+  PROFILE_POP(arena, 0);
   Destroy_LargeMemBlocks(arena->blocks_);
+  arena->blocks_      = NULL;
+  arena->blocks_tail_ = NULL;
   if (os_free_(arena->memory_, arena->total_size_) == ERROR_OS_MEMORY) {
     return ERROR_OS_MEMORY;
   }
@@ -71,12 +84,12 @@ int Destroy_StaticArena(StaticArena* arena) {
   return SUCCESS;
 }
 
-int SetAutoAlign2Pow_StaticArena(StaticArena* arena, int alignment) {
+int SetAutoAlign2Pow_StaticArena(StaticArena* arena, size_t alignment) {
 #ifdef DEBUG
   if (arena == NULL) {
     return ERROR_INVALID_PARAMS;
   }
-  if (__builtin_popcount(alignment) != 1 || alignment < WORD_SIZE) {
+  if (__builtin_popcountll(alignment) != 1 || alignment < WORD_SIZE) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
@@ -94,12 +107,12 @@ inline uintptr_t GetPos_StaticArena(StaticArena* arena) {
   return arena->position_;
 }
 
-int PushAligner_StaticArena(StaticArena* arena, int alignment) {
+int PushAligner_StaticArena(StaticArena* arena, size_t alignment) {
 #ifdef DEBUG
   if (arena == NULL) {
     return ERROR_INVALID_PARAMS;
   }
-  if (__builtin_popcount(alignment) != 1 || alignment < WORD_SIZE) {
+  if (__builtin_popcountll(alignment) != 1 || alignment < WORD_SIZE) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
@@ -113,7 +126,7 @@ int PushAlignerCacheLine_StaticArena(StaticArena* arena) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
-  arena->position_ = align_2pow(arena->position_ + (uintptr_t)arena->memory_, CACHE_LINE_SIZE) - (uintptr_t)arena->memory_;
+  arena->position_ = align_2pow(arena->position_ + (uintptr_t)arena->memory_, _getCacheLineSize()) - (uintptr_t)arena->memory_;
   return SUCCESS;
 }
 int PushAlignerPageSize_StaticArena(StaticArena* arena) {
@@ -125,17 +138,21 @@ int PushAlignerPageSize_StaticArena(StaticArena* arena) {
   arena->position_ = align_2pow(arena->position_ + (uintptr_t)arena->memory_, _getPageSize()) - (uintptr_t)arena->memory_;
   return SUCCESS;
 }
-uint8_t* PushLargeBlock_StaticArena(StaticArena* arena, int bytes) {
-  DEBUG_PRINT("Large block allocation of %d", bytes);
+uint8_t* PushLargeBlock_StaticArena(StaticArena* arena, size_t bytes) {
+  DEBUG_PRINT("Large block allocation of %zu", bytes);
   LargeMemBlock* new_block = Create_LargeMemBlock(bytes, arena->blocks_);
   if (new_block == NULL) {
     DEBUG_PRINT("Failed large block memory allocation");
     return NULL;
   }
+  if (arena->blocks_ == NULL) {
+    arena->blocks_tail_ = new_block;
+  }
   arena->blocks_ = new_block;
+  TRACE_EVENT(TRACE_PUSH_LARGE_BLOCK, TRACE_STATIC, arena, bytes, arena->position_);
   return new_block->memory_;
 }
-uint8_t* PushNoZero_StaticArena(StaticArena* arena, int bytes) {
+uint8_t* PushNoZero_StaticArena(StaticArena* arena, size_t bytes) {
 #ifdef DEBUG
   if (arena == NULL) {
     return NULL;
@@ -144,14 +161,24 @@ uint8_t* PushNoZero_StaticArena(StaticArena* arena, int bytes) {
   if (arena->auto_align_) {
     PushAligner_StaticArena(arena, arena->alignment_);
   }
-  if (arena->position_ + bytes > arena->total_size_) {
-    return PushLargeBlock_StaticArena(arena, bytes);
+  if (!fits_below(arena->position_, bytes, arena->total_size_)) {
+    TRACE_MUTE();
+    uint8_t* mem = PushLargeBlock_StaticArena(arena, bytes);
+    TRACE_UNMUTE();
+    TRACE_EVENT(TRACE_PUSH_NO_ZERO, TRACE_STATIC, arena, bytes, arena->position_);
+    if (mem != NULL) {
+      PROFILE_PUSH_BLOCK(arena, arena->blocks_, bytes);
+    }
+    return mem;
   }
   uint8_t* ptr = arena->memory_ + arena->position_;
+  PROFILE_PUSH(arena, arena->position_, bytes);
+  GUARD_SAMPLE(arena, arena->position_, ptr, bytes, arena->alignment_);
   arena->position_ += bytes;
+  TRACE_EVENT(TRACE_PUSH_NO_ZERO, TRACE_STATIC, arena, bytes, arena->position_);
   return ptr;
 }
-uint8_t* Push_StaticArena(StaticArena* arena, int bytes) {
+uint8_t* Push_StaticArena(StaticArena* arena, size_t bytes) {
 #ifdef DEBUG
   if (arena == NULL) {
     return NULL;
@@ -160,17 +187,42 @@ uint8_t* Push_StaticArena(StaticArena* arena, int bytes) {
   if (arena->auto_align_) {
     PushAligner_StaticArena(arena, arena->alignment_);
   }
-  if (arena->position_ + bytes > arena->total_size_) {
+  if (!fits_below(arena->position_, bytes, arena->total_size_)) {
+    TRACE_MUTE();
     uint8_t* mem = PushLargeBlock_StaticArena(arena, bytes);
-    memset(mem, 0, bytes);
+    TRACE_UNMUTE();
+    TRACE_EVENT(TRACE_PUSH, TRACE_STATIC, arena, bytes, arena->position_);
+    if (mem != NULL) {
+      PROFILE_PUSH_BLOCK(arena, arena->blocks_, bytes);
+      memset(mem, 0, bytes);
+    }
     return mem;
   }
   uint8_t* ptr = arena->memory_ + arena->position_;
+  PROFILE_PUSH(arena, arena->position_, bytes);
+  GUARD_SAMPLE(arena, arena->position_, ptr, bytes, arena->alignment_);
   arena->position_ += bytes;
+  TRACE_EVENT(TRACE_PUSH, TRACE_STATIC, arena, bytes, arena->position_);
   memset(ptr, 0, bytes);
   return ptr;
 }
 
+// For data written by one thread while others write next to it: starts on its own cache line and is padded to whole
+// lines, so that the next push cannot share one with it. Zeroed.
+uint8_t* PushCrossThread_StaticArena(StaticArena* arena, size_t bytes) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return NULL;
+  }
+#endif
+  size_t alignment = _getCrossThreadAlignment();
+  if (align_2pow_overflow(bytes, alignment, &bytes)) {
+    return NULL;
+  }
+  PushAligner_StaticArena(arena, alignment);
+  return Push_StaticArena(arena, bytes);
+}
+
 int Pop_StaticArena(StaticArena* arena, uintptr_t bytes) {
   // Be careful, if auto align is on, the aligner allocated bytes are unseen to you. You should use pop to position or address if autoalign
   // is on.
@@ -179,10 +231,13 @@ int Pop_StaticArena(StaticArena* arena, uintptr_t bytes) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
-  if (arena->position_ < bytes) {
-    bytes = arena->position_;
+  if (arena->position_ - arena->color_ < bytes) {
+    bytes = arena->position_ - arena->color_;
   }
   arena->position_ -= bytes;
+  GUARD_POP(arena, arena->position_);
+  PROFILE_POP(arena, arena->position_);
+  TRACE_EVENT(TRACE_POP, TRACE_STATIC, arena, bytes, arena->position_);
   return SUCCESS;
 }
 int PopTo_StaticArena(StaticArena* arena, uintptr_t position) {
@@ -192,8 +247,11 @@ int PopTo_StaticArena(StaticArena* arena, uintptr_t position) {
   }
 #endif
   if (position < arena->position_) {
-    arena->position_ = position;
+    arena->position_ = position > arena->color_ ? position : arena->color_;
   }
+  GUARD_POP(arena, arena->position_);
+  PROFILE_POP(arena, arena->position_);
+  TRACE_EVENT(TRACE_POP_TO, TRACE_STATIC, arena, 0, arena->position_);
   return SUCCESS;
 }
 int PopToAdress_StaticArena(StaticArena* arena, uint8_t* address) {
@@ -202,14 +260,22 @@ int PopToAdress_StaticArena(StaticArena* arena, uint8_t* address) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
+  address                  = GUARD_ADDRESS(arena, address);
   uintptr_t final_position = address - arena->memory_;
   if ((uintptr_t)(arena->memory_) < (uintptr_t)address) {
-    arena->position_ = final_position;
+    arena->position_ = final_position > arena->color_ ? final_position : arena->color_;
   }
+  GUARD_POP(arena, arena->position_);
+  PROFILE_POP(arena, arena->position_);
+  TRACE_EVENT(TRACE_POP_TO, TRACE_STATIC, arena, 0, arena->position_);
   return SUCCESS;
 }
 int PopLargeBlock_StaticArena(StaticArena* arena) {
   arena->blocks_ = Pop_LargeMemoryBlock(arena->blocks_);
+  if (arena->blocks_ == NULL) {
+    arena->blocks_tail_ = NULL;
+  }
+  TRACE_EVENT(TRACE_POP_LARGE_BLOCK, TRACE_STATIC, arena, 0, arena->position_);
   return SUCCESS;
 }
 
@@ -219,36 +285,49 @@ int Clear_StaticArena(StaticArena* arena) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
-  arena->position_ = 0;
+  arena->position_ = arena->color_;
+  GUARD_POP(arena, 0);
+  PROFILE_POP(arena, 0);
   Destroy_LargeMemBlocks(arena->blocks_);
+  arena->blocks_      = NULL;
+  arena->blocks_tail_ = NULL;
+  TRACE_EVENT(TRACE_CLEAR, TRACE_STATIC, arena, 0, 0);
   return SUCCESS;
 }
 
 // Essentially, the scratch space is another arena of the same type rooted at the top pointer. Only works for static I guess.
-int InitScratch_StaticArena(StaticArena* scratch_space, StaticArena* parent_arena, int arena_size, int auto_align) {
+int InitScratch_StaticArena(StaticArena* scratch_space, StaticArena* parent_arena, size_t arena_size, size_t auto_align) {
 #ifdef DEBUG
   if (scratch_space == NULL || scratch_space == NULL) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
+  GUARD_SUSPEND();
+  PROFILE_SUSPEND();
   uint8_t* mem = PushNoZero_StaticArena(parent_arena, arena_size);
+  PROFILE_RESUME();
+  GUARD_RESUME();
   if (mem == NULL) {
     return ERROR_OS_MEMORY;
   }
 
   scratch_space->memory_ = mem;
 
-  scratch_space->total_size_ = arena_size;
-  scratch_space->position_   = 0;
-  scratch_space->blocks_     = NULL;
-  int word_size              = WORD_SIZE;
-  if (auto_align > word_size && __builtin_popcount(auto_align) == 1) {
+  scratch_space->total_size_  = arena_size;
+  scratch_space->position_    = 0;
+  scratch_space->color_       = 0;
+  scratch_space->blocks_      = NULL;
+  scratch_space->blocks_tail_ = NULL;
+  size_t word_size              = WORD_SIZE;
+  if (auto_align > word_size && __builtin_popcountll(auto_align) == 1) {
     scratch_space->auto_align_ = TRUE;
     scratch_space->alignment_  = auto_align;
   } else {
     scratch_space->auto_align_ = FALSE;
     scratch_space->alignment_  = word_size;
   }
+  TRACE_EVENT_FLAGS(TRACE_INIT_SCRATCH, TRACE_STATIC, scratch_space, (uintptr_t)parent_arena, arena_size,
+                    scratch_space->auto_align_ ? __builtin_ctzll(scratch_space->alignment_) : 0);
   return SUCCESS;
 }
 int DestroyScratch_StaticArena(StaticArena* scratch_space, StaticArena* parent_arena) {
@@ -260,9 +339,13 @@ int DestroyScratch_StaticArena(StaticArena* scratch_space, StaticArena* parent_a
   // Null properties and pop memory
   parent_arena->position_ -= scratch_space->total_size_;
   scratch_space->memory_ = NULL;
+  GUARD_POP(scratch_space, 0);
+  PROFILE_POP(scratch_space, 0);
+  TRACE_EVENT(TRACE_DESTROY_SCRATCH, TRACE_STATIC, scratch_space, (uintptr_t)parent_arena, parent_arena->position_);
 
   Destroy_LargeMemBlocks(scratch_space->blocks_);
-  scratch_space->blocks_ = NULL;
+  scratch_space->blocks_      = NULL;
+  scratch_space->blocks_tail_ = NULL;
 
   scratch_space->total_size_ = 0;
   scratch_space->position_   = 0;
@@ -273,11 +356,18 @@ int DestroyScratch_StaticArena(StaticArena* scratch_space, StaticArena* parent_a
 int MergeScratch_StaticArena(StaticArena* scratch_space, StaticArena* parent_arena) {
   // Set the new position to conserve the memory from the scratch space and null properties
   // No need to do bounds check as the memory addresses must be properly ordered, and the position too.
+  GUARD_MERGE(scratch_space, parent_arena, (uintptr_t)scratch_space->memory_ - (uintptr_t)parent_arena->memory_);
+  PROFILE_MERGE(scratch_space, parent_arena, (uintptr_t)scratch_space->memory_ - (uintptr_t)parent_arena->memory_);
   parent_arena->position_ = ((uintptr_t)scratch_space->memory_ - (uintptr_t)parent_arena->memory_) + scratch_space->position_;
   scratch_space->memory_  = NULL;
+  TRACE_EVENT(TRACE_MERGE_SCRATCH, TRACE_STATIC, scratch_space, (uintptr_t)parent_arena, parent_arena->position_);
 
-  parent_arena->blocks_  = Merge_LargeMemBlocks(scratch_space->blocks_, parent_arena->blocks_);
-  scratch_space->blocks_ = NULL;
+  if (parent_arena->blocks_tail_ == NULL) {
+    parent_arena->blocks_tail_ = scratch_space->blocks_tail_;
+  }
+  parent_arena->blocks_       = Splice_LargeMemBlocks(scratch_space->blocks_, scratch_space->blocks_tail_, parent_arena->blocks_);
+  scratch_space->blocks_      = NULL;
+  scratch_space->blocks_tail_ = NULL;
 
   scratch_space->total_size_ = 0;
   scratch_space->position_   = 0;
@@ -286,4 +376,95 @@ int MergeScratch_StaticArena(StaticArena* scratch_space, StaticArena* parent_are
   return SUCCESS;
 }
 
+// Fork-join scratch spaces. The space left in the parent is split into count scratch spaces of the same size, one per
+// worker, each starting on its own cache line (or the parent's auto alignment, if larger). MergeScratches_* then packs
+// the used range of each one right behind the previous one, in order, so workers build the result in place and the
+// only copy is that compaction; the first scratch never moves. Pointers into the other scratches go stale on merge,
+// offsets (if not NULL) receives where each one landed in the parent. Alignment up to that of the split is kept.
+// Init, merge and destroy are called by the parent owner, the scratch spaces are single-threaded as usual.
+static size_t scratches_alignment_(int auto_align, size_t alignment) {
+  size_t cross_thread = _getCrossThreadAlignment();
+  return auto_align && alignment > cross_thread ? alignment : cross_thread;
+}
+static size_t scratches_size_(uintptr_t position, uintptr_t total_size, size_t count, size_t alignment) {
+  size_t remaining = position < total_size ? total_size - position : 0;
+  return (remaining / count) & ~(alignment - 1);
+}
+// Moves a scratch's used range to destination and hands its large blocks to the chain in blocks
+static void compact_scratch_(StaticArena* scratch_space, uint8_t* destination, LargeMemBlock** blocks) {
+  if (destination != scratch_space->memory_) {
+    memmove(destination, scratch_space->memory_, scratch_space->position_);
+  }
+  *blocks                     = Splice_LargeMemBlocks(scratch_space->blocks_, scratch_space->blocks_tail_, *blocks);
+  scratch_space->memory_      = NULL;
+  scratch_space->blocks_      = NULL;
+  scratch_space->blocks_tail_ = NULL;
+  scratch_space->total_size_  = 0;
+  scratch_space->position_    = 0;
+  scratch_space->auto_align_  = 0;
+  scratch_space->alignment_   = 0;
+}
+
+int DestroyScratches_StaticArena(StaticArena* scratches, size_t count, StaticArena* parent_arena) {
+#ifdef DEBUG
+  if (scratches == NULL || parent_arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  while (count > 0) {
+    DestroyScratch_StaticArena(&scratches[--count], parent_arena);
+  }
+  return SUCCESS;
+}
+int InitScratches_StaticArena(StaticArena* scratches, size_t count, StaticArena* parent_arena, size_t auto_align) {
+#ifdef DEBUG
+  if (scratches == NULL || parent_arena == NULL || count == 0) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  // A failure leaves the parent where it was, the alignment padding included
+  uintptr_t position  = parent_arena->position_;
+  size_t    alignment = scratches_alignment_(parent_arena->auto_align_, parent_arena->alignment_);
+  PushAligner_StaticArena(parent_arena, alignment);
+  size_t arena_size = scratches_size_(parent_arena->position_, parent_arena->total_size_, count, alignment);
+  if (arena_size == 0) {
+    parent_arena->position_ = position;
+    return ERROR_OS_MEMORY;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (InitScratch_StaticArena(&scratches[i], parent_arena, arena_size, auto_align) != SUCCESS) {
+      DestroyScratches_StaticArena(scratches, i, parent_arena);
+      parent_arena->position_ = position;
+      return ERROR_OS_MEMORY;
+    }
+  }
+  return SUCCESS;
+}
+int MergeScratches_StaticArena(StaticArena* scratches, size_t count, StaticArena* parent_arena, uintptr_t* offsets) {
+#ifdef DEBUG
+  if (scratches == NULL || parent_arena == NULL || count == 0) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  size_t    alignment = scratches_alignment_(parent_arena->auto_align_, parent_arena->alignment_);
+  uintptr_t position  = (uintptr_t)scratches[0].memory_ - (uintptr_t)parent_arena->memory_;
+  for (size_t i = 0; i < count; i++) {
+    StaticArena* scratch_space = &scratches[i];
+    uintptr_t    base = align_2pow(position + (uintptr_t)parent_arena->memory_, alignment) - (uintptr_t)parent_arena->memory_;
+    GUARD_MERGE(scratch_space, parent_arena, base);
+    PROFILE_MERGE(scratch_space, parent_arena, base);
+    if (offsets != NULL) {
+      offsets[i] = base;
+    }
+    position                = base + scratch_space->position_;
+    parent_arena->position_ = position;
+    TRACE_EVENT(TRACE_MERGE_SCRATCH, TRACE_STATIC, scratch_space, (uintptr_t)parent_arena, parent_arena->position_);
+    if (parent_arena->blocks_tail_ == NULL) {
+      parent_arena->blocks_tail_ = scratch_space->blocks_tail_;
+    }
+    compact_scratch_(scratch_space, parent_arena->memory_ + base, &parent_arena->blocks_);
+  }
+  return SUCCESS;
+}
+
 #endif
\ No newline at end of file
@@ -1,11 +1,406 @@
+#include <assert.h>
 #include <stdio.h>
-#include "static_arena.h"
+#include "chained_arena.h"
+#include "epoch.h"
+#include "handle_arena.h"
+#include "layout.h"
+#include "pool.h"
+#ifdef __linux__
+#include <pthread.h>
+#include "snapshot.h"
+#endif
+#include "virtual_arena.h"
+
+#define GiB ((size_t)1024 * 1024 * 1024)
+#define TiB (GiB * 1024)
+
+#ifdef __linux__
+typedef struct RemoteFrees {
+    FixedPool* pool_;
+    void**     blocks_;
+    size_t     count_;
+} RemoteFrees;
+
+static void* FreeRemote(void* argument) {
+  RemoteFrees* frees = (RemoteFrees*)argument;
+  for (size_t i = 0; i < frees->count_; i++) {
+    FreeRemote_FixedPool(frees->pool_, frees->blocks_[i]);
+  }
+  return NULL;
+}
+
+typedef struct EpochHold {
+    EpochManager* manager_;
+    int           inside_;
+    int           release_;
+} EpochHold;
+
+static void* HoldEpoch(void* argument) {
+  EpochHold* hold   = (EpochHold*)argument;
+  int        reader = Register_EpochManager(hold->manager_);
+  Enter_EpochManager(hold->manager_, reader);
+  __atomic_store_n(&hold->inside_, 1, __ATOMIC_RELEASE);
+  while (!__atomic_load_n(&hold->release_, __ATOMIC_ACQUIRE)) {
+    sched_yield();
+  }
+  Exit_EpochManager(hold->manager_, reader);
+  Unregister_EpochManager(hold->manager_, reader);
+  return NULL;
+}
+
+typedef struct EpochReads {
+    EpochManager* manager_;
+    uint8_t*      published_;
+    int           stop_;
+} EpochReads;
+
+// Reads whatever is published, a reclaim while inside unmaps it under the reader
+static void* ReadEpoch(void* argument) {
+  EpochReads* reads  = (EpochReads*)argument;
+  int         reader = Register_EpochManager(reads->manager_);
+  while (!__atomic_load_n(&reads->stop_, __ATOMIC_ACQUIRE)) {
+    Enter_EpochManager(reads->manager_, reader);
+    uint8_t* data = __atomic_load_n(&reads->published_, __ATOMIC_ACQUIRE);
+    assert(data[0] != 0 && data[0] == data[255]);
+    Exit_EpochManager(reads->manager_, reader);
+  }
+  Unregister_EpochManager(reads->manager_, reader);
+  return NULL;
+}
+#endif
 
 int main() {
-  bool a = 0;
+  printf("PAGE SIZE: %zu\n", _getPageSize());
+
+  // Multi-terabyte reservation, only the pages we touch get committed
+  VirtualArena arena;
+  assert(Init_VirtualArena(&arena, 4 * TiB, 0, FALSE) == SUCCESS);
+  for (int i = 0; i < 3; i++) {
+    uint8_t* mem = PushNoZero_VirtualArena(&arena, 3 * GiB);
+    assert(mem == arena.memory_ + (size_t)i * 3 * GiB);
+    mem[0]           = 1;
+    mem[3 * GiB - 1] = 1;
+  }
+  assert(GetPos_VirtualArena(&arena) == 9 * GiB);
+  PopTo_VirtualArena(&arena, 5 * GiB);
+  assert(GetPos_VirtualArena(&arena) == 5 * GiB);
+  // Sizes that cannot fit must fail instead of wrapping around
+  assert(PushNoZero_VirtualArena(&arena, SIZE_MAX - GiB) == NULL);
+  assert(Create_LargeMemBlock(SIZE_MAX - 16, NULL) == NULL);
+  Destroy_VirtualArena(&arena);
+
+  // Past the end of a static arena, a large block above 2 GiB
+  StaticArena static_arena;
+  assert(Init_StaticArena(&static_arena, 64 * 1024 * 1024, 0) == SUCCESS);
+  uint8_t* block = PushNoZero_StaticArena(&static_arena, 3 * GiB + 5);
+  assert(block != NULL && static_arena.blocks_ != NULL);
+  block[0]           = 1;
+  block[3 * GiB + 4] = 1;
+  assert(static_arena.blocks_->block_size_ == 3 * GiB + 5);
+  Destroy_StaticArena(&static_arena);
+
+  // Compaction keeps odd-sized allocations packed where they were pushed, with and without auto alignment
+  for (size_t align = 0; align <= 16; align += 16) {
+    HandleArena handles;
+    assert(Init_HandleArena(&handles, 64 * 1024, 16, align) == SUCCESS);
+    ArenaHandle sizes[4] = {3, 6, 8, 5};
+    ArenaHandle h[4];
+    for (int i = 0; i < 4; i++) {
+      h[i] = Alloc_HandleArena(&handles, sizes[i]);
+      memset(Get_HandleArena(&handles, h[i]), 'a' + i, sizes[i]);
+    }
+    Free_HandleArena(&handles, h[0]);
+    Free_HandleArena(&handles, h[2]);
+    assert(Compact_HandleArena(&handles) == SUCCESS);
+    for (int i = 1; i < 4; i += 2) {
+      uint8_t* mem = Get_HandleArena(&handles, h[i]);
+      for (ArenaHandle j = 0; j < sizes[i]; j++) {
+        assert(mem[j] == 'a' + i);
+      }
+    }
+    uint8_t* last = Get_HandleArena(&handles, h[3]);
+    assert(last + sizes[3] == handles.arena_.memory_ + handles.arena_.position_);
+    assert(handles.arena_.position_ == (align ? 16 + 5 : 6 + 5) + handles.arena_.color_);
+    Destroy_HandleArena(&handles);
+  }
+
+  // Layouts that fall back to a large block stay inside it, large blocks end at the end of their mapping
+  for (size_t used = 60 * 1024; used <= 60 * 1024 + 8; used += 8) {
+    StaticArena layout_arena;
+    assert(Init_StaticArena(&layout_arena, 64 * 1024, 0) == SUCCESS);
+    PushNoZero_StaticArena(&layout_arena, used);
+    ColumnDesc     columns[2] = {{8, 1000, 64}, {3, 1001, 256}};
+    void*          out[2];
+    uint8_t*       base  = PushLayoutNoZero_StaticArena(&layout_arena, columns, 2, 0, out);
+    LargeMemBlock* block = layout_arena.blocks_;
+    assert(base != NULL && block != NULL && (uintptr_t)base % 256 == 0 && (uintptr_t)out[1] % 256 == 0);
+    assert(base >= block->memory_ && (uint8_t*)out[1] + 3 * 1001 <= block->memory_ + block->block_size_);
+    memset(out[1], 1, 3 * 1001);
+    Destroy_StaticArena(&layout_arena);
+  }
+
+  // A layout that cannot be pushed leaves the arena as it was, columns default to the detected line size
+  {
+    StaticArena layout_arena;
+    assert(Init_StaticArena(&layout_arena, 64 * 1024, 64) == SUCCESS);
+    PushNoZero_StaticArena(&layout_arena, 3);
+    uintptr_t  position   = layout_arena.position_;
+    ColumnDesc columns[2] = {{4, 10, 0}, {SIZE_MAX, 2, 0}};
+    void*      out[2];
+    assert(PushLayout_StaticArena(&layout_arena, columns, 2, 0, out) == NULL && layout_arena.position_ == position);
+    columns[1].element_size_ = 1;
+    assert(PushLayout_StaticArena(&layout_arena, columns, 2, 0, out) == out[0]);
+    assert((uintptr_t)out[0] % _getCacheLineSize() == 0 && (uintptr_t)out[1] % _getCacheLineSize() == 0);
+    assert((uint8_t*)out[1] - (uint8_t*)out[0] == (ptrdiff_t)_getCacheLineSize());
+    Destroy_StaticArena(&layout_arena);
+  }
+
+  // Fork-join scratches that use up the reserve exactly stay inside the parent
+  for (size_t count = 1; count <= 4; count *= 4) {
+    VirtualArena parent;
+    StaticArena  scratches[4];
+    uintptr_t    offsets[4];
+    assert(Init_VirtualArena(&parent, 1024 * 1024, 0, FALSE) == SUCCESS);
+    PushNoZero_VirtualArena(&parent, 256 - parent.color_ % 256);
+    uintptr_t start = parent.position_;
+    assert(InitScratches_VirtualArena(scratches, count, &parent, 0) == SUCCESS);
+    assert(parent.position_ == parent.total_size_ && parent.blocks_ == NULL);
+    for (size_t i = 0; i < count; i++) {
+      assert(scratches[i].memory_ == parent.memory_ + start + i * scratches[0].total_size_);
+      memset(Push_StaticArena(&scratches[i], 10), (int)i + 1, 10);
+    }
+    assert(MergeScratches_VirtualArena(scratches, count, &parent, offsets) == SUCCESS);
+    assert(parent.position_ == offsets[count - 1] + 10 && parent.blocks_ == NULL);
+    for (size_t i = 0; i < count; i++) {
+      assert(offsets[i] == start + i * 64 && parent.memory_[offsets[i] + 9] == i + 1);
+    }
+    PopTo_VirtualArena(&parent, start);
+    assert(InitScratches_VirtualArena(scratches, count, &parent, 0) == SUCCESS);
+    DestroyScratches_VirtualArena(scratches, count, &parent);
+    assert(parent.position_ == start);
+    Destroy_VirtualArena(&parent);
+  }
+
+  // Scratches that do not fit leave the parent unaligned
+  {
+    StaticArena parent;
+    StaticArena scratches[4];
+    assert(Init_StaticArena(&parent, 64 * 1024, 0) == SUCCESS);
+    PushNoZero_StaticArena(&parent, 64 * 1024 - parent.position_ - 3);
+    uintptr_t position = parent.position_;
+    assert(InitScratches_StaticArena(scratches, 4, &parent, 0) == ERROR_OS_MEMORY && parent.position_ == position);
+    Destroy_StaticArena(&parent);
+  }
+
+  // Commit targets of the policy presets, in pages
+  {
+    size_t      page = _getPageSize();
+    ArenaPolicy policy;
+    Init_GeometricPolicy(&policy);
+    assert(policy.extend_(&policy, page, 5 * page) == 16 * page);
+    assert(policy.reduce_(&policy, 16 * page, 16 * page, page) == 2 * page && policy.reduce_(&policy, 16 * page, 16 * page, 0) == page);
+    assert(Init_LinearPolicy(&policy, 3 * page - 100) == SUCCESS && policy.step_ == 3 * page);
+    assert(policy.extend_(&policy, page, 5 * page) == 7 * page);
+    assert(policy.reduce_(&policy, 10 * page, 10 * page, 2 * page) == 5 * page && policy.reduce_(&policy, 7 * page, 7 * page, 2 * page) == 7 * page);
+    assert(Init_FixedStepPolicy(&policy, 2 * page) == SUCCESS);
+    assert(policy.extend_(&policy, page, 3 * page + 1) == 4 * page);
+    assert(policy.reduce_(&policy, 8 * page, 8 * page, 3 * page) == 4 * page && policy.reduce_(&policy, 2 * page, 2 * page, 3 * page) == 2 * page);
+    Init_HugePagePolicy(&policy);
+    assert(policy.huge_pages_ && policy.extend_(&policy, page, 5 * page) == HUGE_PAGE_SIZE);
+    assert(policy.reduce_(&policy, 4 * HUGE_PAGE_SIZE, 4 * HUGE_PAGE_SIZE, 3 * HUGE_PAGE_SIZE / 2) == 4 * HUGE_PAGE_SIZE);
+    assert(policy.reduce_(&policy, 4 * HUGE_PAGE_SIZE, 4 * HUGE_PAGE_SIZE, page) == HUGE_PAGE_SIZE);
+    // Adaptive grows 25% past the request, at least doubling, and straight to the peak once it has one
+    Init_AdaptivePolicy(&policy);
+    assert(policy.extend_(&policy, page, 10 * page) == 13 * page && policy.extend_(&policy, 8 * page, 10 * page) == 16 * page);
+    assert(policy.reduce_(&policy, 13 * page, 10 * page, 0) == 13 * page && policy.peak_ == 10 * page);
+    assert(policy.extend_(&policy, page, 2 * page) == 13 * page);
+    // The peak decays by 1/16 per pop, the commit only shrinks once it is 50% above the target
+    size_t peak = policy.peak_;
+    size_t kept;
+    while ((kept = policy.reduce_(&policy, 13 * page, page, 0)) == 13 * page) {
+      assert(policy.peak_ == peak - peak / 16 && 13 * page - 13 * page / 3 <= align_2pow(peak + peak / 4, page));
+      peak = policy.peak_;
+    }
+    assert(kept == align_2pow(policy.peak_ + policy.peak_ / 4, page) && 13 * page - 13 * page / 3 > kept);
+    // A target rounded past the reservation does not remap while the push fits
+    VirtualArena remapped;
+    assert(Init_VirtualArena(&remapped, 1024 * 1024, 0, TRUE) == SUCCESS);
+    Init_HugePagePolicy(&policy);
+    assert(SetPolicy_VirtualArena(&remapped, &policy) == SUCCESS);
+    uint8_t* start = remapped.memory_;
+    assert(PushNoZero_VirtualArena(&remapped, 1024 * 1024 - remapped.position_) == start + remapped.color_);
+    assert(remapped.memory_ == start && remapped.total_size_ == 1024 * 1024 && remapped.committed_size_ == 1024 * 1024);
+    assert(PushNoZero_VirtualArena(&remapped, 8) != NULL && remapped.total_size_ > 1024 * 1024);
+    Destroy_VirtualArena(&remapped);
+  }
+
+  // Chained arenas grow into new chunks without moving, pops walk back down across chunks
+  {
+    size_t       page = _getPageSize();
+    ChainedArena chained;
+    assert(Init_ChainedArena(&chained, 4 * page, 0) == SUCCESS);
+    uintptr_t bottom = chained.position_;
+    uint8_t*  first  = PushNoZero_ChainedArena(&chained, 3 * page);
+    memset(first, 1, 3 * page);
+    uint8_t*    second = Push_ChainedArena(&chained, 2 * page);
+    ArenaChunk* top    = chained.chunk_;
+    assert(second == top->memory_ && top->index_ == 1 && chained.position_ == 2 * page && first[3 * page - 1] == 1);
+    // The released chunk is kept as the spare and reused by the next growth
+    assert(Pop_ChainedArena(&chained, 3 * page) == SUCCESS);
+    assert(chained.chunk_->index_ == 0 && chained.position_ == bottom + 2 * page && chained.spare_chunk_ == top);
+    ChainedArenaPos middle = GetPos_ChainedArena(&chained);
+    assert(Push_ChainedArena(&chained, 3 * page) == top->memory_ && chained.chunk_ == top && chained.spare_chunk_ == NULL);
+    assert(PopTo_ChainedArena(&chained, middle) == SUCCESS);
+    assert(chained.chunk_->index_ == 0 && chained.position_ == middle.offset_ && chained.spare_chunk_ == top);
+    assert(PushNoZero_ChainedArena(&chained, 3 * page) == top->memory_ && chained.chunk_ == top);
+    assert(PopToAdress_ChainedArena(&chained, first + page) == SUCCESS);
+    assert(chained.chunk_->index_ == 0 && chained.position_ == bottom + page && first[0] == 1);
+    // Scratches are carved from the top chunk, destroying one gives its commit back
+    StaticArena scratch;
+    PushNoZero_ChainedArena(&chained, 4 * page);
+    Pop_ChainedArena(&chained, 4 * page - 64);
+    assert(chained.chunk_ == top && chained.position_ == 64);
+    assert(InitScratch_ChainedArena(&scratch, &chained, 12 * page, 0) == SUCCESS);
+    assert(scratch.memory_ == top->memory_ + 64 && chained.committed_size_ >= 64 + 12 * page);
+    memset(scratch.memory_, 2, 12 * page);
+    assert(DestroyScratch_ChainedArena(&scratch, &chained) == SUCCESS);
+    assert(chained.position_ == 64 && chained.committed_size_ == page);
+    assert(InitScratch_ChainedArena(&scratch, &chained, 2 * page, 0) == SUCCESS);
+    uint8_t* kept = Push_StaticArena(&scratch, 100);
+    memset(kept, 3, 100);
+    assert(MergeScratch_ChainedArena(&scratch, &chained) == SUCCESS);
+    assert(chained.chunk_ == top && chained.position_ == 64 + 100 && kept == top->memory_ + 64 && kept[99] == 3);
+    Destroy_ChainedArena(&chained);
+  }
+
+  // Pool round-trips across bitmap words, freed blocks come back lowest first
+  StaticArena pool_arena;
+  FixedPool   pool;
+  void*       batch[130];
+  void*       again[130];
+  assert(Init_StaticArena(&pool_arena, 64 * 1024, 0) == SUCCESS);
+  // A pool whose blocks cannot be mapped gives back its bitmap and alignment
+  uintptr_t pool_position = pool_arena.position_ + 8;
+  PushNoZero_StaticArena(&pool_arena, 8);
+  assert(InitPool_StaticArena(&pool, &pool_arena, 1 << 20, (size_t)1 << 27) == ERROR_OS_MEMORY);
+  assert(pool_arena.position_ == pool_position && pool_arena.blocks_ == NULL);
+  assert(InitPool_StaticArena(&pool, &pool_arena, 24, 130) == SUCCESS);
+  assert(AllocBatch_FixedPool(&pool, batch, 70) == 70 && pool.used_ == 70);
+  for (size_t i = 0; i < 70; i++) {
+    assert(batch[i] == Block_FixedPool(&pool, i));
+  }
+  assert(AllocBatch_FixedPool(&pool, batch + 70, 100) == 60 && Alloc_FixedPool(&pool) == NULL);
+  assert(Free_FixedPool(&pool, batch[63]) == SUCCESS && Free_FixedPool(&pool, batch[64]) == SUCCESS);
+  assert(Free_FixedPool(&pool, batch[129]) == SUCCESS && pool.used_ == 127);
+  assert(NextUsed_FixedPool(&pool, 63) == 65 && NextUsed_FixedPool(&pool, 129) == 130);
+  assert(Alloc_FixedPool(&pool) == batch[63] && Alloc_FixedPool(&pool) == batch[64]);
+  assert(Alloc_FixedPool(&pool) == batch[129] && Alloc_FixedPool(&pool) == NULL);
+  assert(FreeBatch_FixedPool(&pool, batch + 60, 10) == SUCCESS && pool.used_ == 120);
+  assert(AllocBatch_FixedPool(&pool, again, 130) == 10 && pool.used_ == 130);
+  for (size_t i = 0; i < 10; i++) {
+    assert(again[i] == batch[60 + i]);
+  }
+  assert(Clear_FixedPool(&pool) == SUCCESS && NextUsed_FixedPool(&pool, 0) == 130);
+  assert(AllocBatch_FixedPool(&pool, again, 130) == 130 && memcmp(again, batch, sizeof(batch)) == 0);
+#ifdef __linux__
+  // Blocks freed on another thread are reused once the owner drains them
+  pthread_t   thread;
+  RemoteFrees frees = {&pool, batch + 60, 10};
+  assert(pthread_create(&thread, NULL, FreeRemote, &frees) == 0 && pthread_join(thread, NULL) == 0);
+  assert(pool.used_ == 130 && Alloc_FixedPool(&pool) == batch[60] && pool.used_ == 121);
+  assert(AllocBatch_FixedPool(&pool, again, 130) == 9 && again[8] == batch[69]);
+  frees = (RemoteFrees){&pool, batch + 127, 3};
+  assert(pthread_create(&thread, NULL, FreeRemote, &frees) == 0 && pthread_join(thread, NULL) == 0);
+  assert(DrainRemote_FixedPool(&pool) == 3 && DrainRemote_FixedPool(&pool) == 0 && pool.used_ == 127);
+  assert(NextUsed_FixedPool(&pool, 127) == 130 && Alloc_FixedPool(&pool) == batch[127]);
+#endif
+  Destroy_StaticArena(&pool_arena);
+
+#ifdef __linux__
+  // Nothing retired while a reader is inside is reclaimed before it leaves, reclaimed arenas are recycled up to the limit
+  {
+    EpochManager manager;
+    EpochHold    hold = {&manager, 0, 0};
+    VirtualArena retired[3];
+    assert(Init_EpochManager(&manager, 1) == SUCCESS);
+    assert(pthread_create(&thread, NULL, HoldEpoch, &hold) == 0);
+    while (!__atomic_load_n(&hold.inside_, __ATOMIC_ACQUIRE)) {
+      sched_yield();
+    }
+    assert(Init_VirtualArena(&retired[0], 1024 * 1024, 0, FALSE) == SUCCESS);
+    uint8_t* recycled = retired[0].memory_;
+    uint8_t* held     = Push_VirtualArena(&retired[0], 64);
+    assert(RetireVirtual_EpochManager(&manager, &retired[0]) == SUCCESS && retired[0].memory_ == NULL);
+    assert(Reclaim_EpochManager(&manager) == 1 && Reclaim_EpochManager(&manager) == 1 && manager.recycled_count_ == 0);
+    held[63] = 1;
+    __atomic_store_n(&hold.release_, 1, __ATOMIC_RELEASE);
+    assert(pthread_join(thread, NULL) == 0);
+    assert(Reclaim_EpochManager(&manager) == 0 && manager.recycled_count_ == 1);
+    for (int i = 1; i < 3; i++) {
+      assert(Init_VirtualArena(&retired[i], 1024 * 1024, 0, FALSE) == SUCCESS);
+      assert(RetireVirtual_EpochManager(&manager, &retired[i]) == SUCCESS);
+    }
+    assert(Reclaim_EpochManager(&manager) == 0 && manager.recycled_count_ == 1);
+    assert(Acquire_EpochManager(&manager, &retired[0], 512 * 1024, 64, FALSE) == SUCCESS && manager.recycled_count_ == 0);
+    assert(retired[0].memory_ == recycled && retired[0].position_ == retired[0].color_ && retired[0].alignment_ == 64);
+    assert(Acquire_EpochManager(&manager, &retired[1], 512 * 1024, 0, FALSE) == SUCCESS && retired[1].memory_ != recycled);
+    Destroy_VirtualArena(&retired[0]);
+    Destroy_VirtualArena(&retired[1]);
+
+    // Readers keep entering and leaving while the writer publishes, retires and reclaims without recycling
+    EpochReads reads = {&manager, NULL, 0};
+    pthread_t  readers[2];
+    manager.recycle_limit_ = 0;
+    assert(Init_VirtualArena(&retired[0], 1024 * 1024, 0, FALSE) == SUCCESS);
+    reads.published_ = (uint8_t*)memset(Push_VirtualArena(&retired[0], 256), 1, 256);
+    for (int i = 0; i < 2; i++) {
+      assert(pthread_create(&readers[i], NULL, ReadEpoch, &reads) == 0);
+    }
+    for (int i = 0; i < 500; i++) {
+      VirtualArena* next = &retired[(i + 1) % 2];
+      assert(Init_VirtualArena(next, 1024 * 1024, 0, FALSE) == SUCCESS);
+      __atomic_store_n(&reads.published_, (uint8_t*)memset(Push_VirtualArena(next, 256), i % 255 + 1, 256), __ATOMIC_RELEASE);
+      assert(RetireVirtual_EpochManager(&manager, &retired[i % 2]) == SUCCESS);
+      Reclaim_EpochManager(&manager);
+    }
+    __atomic_store_n(&reads.stop_, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < 2; i++) {
+      assert(pthread_join(readers[i], NULL) == 0);
+    }
+    assert(Reclaim_EpochManager(&manager) == 0 && manager.recycled_count_ == 0);
+    Destroy_VirtualArena(&retired[0]);
+    Destroy_EpochManager(&manager);
+  }
 
-  printf("%d\n", a);
-  printf("PAGE SIZE: %d\n", _getPageSize());
+  // Checkpoint, rollback and release, only the written pages are copied back
+  SnapshotArena snapshot;
+  size_t        page = _getPageSize();
+  assert(Init_SnapshotArena(&snapshot, 256 * page, 0) == SUCCESS);
+  uint8_t* pages = PushNoZero_VirtualArena(&snapshot.arena_, 8 * page);
+  memset(pages, 'a', 8 * page);
+  assert(Checkpoint_SnapshotArena(&snapshot) == SUCCESS);
+  pages[0]        = 'b';
+  pages[5 * page] = 'b';
+  uint8_t* later  = Push_VirtualArena(&snapshot.arena_, 16 * page);
+  later[0]        = 'c';
+  PushLargeBlock_VirtualArena(&snapshot.arena_, 4 * page);
+  assert(Rollback_SnapshotArena(&snapshot) == SUCCESS);
+  assert(pages[0] == 'a' && pages[5 * page] == 'a' && pages[8 * page - 1] == 'a');
+  assert(snapshot.arena_.position_ == snapshot.position_ && snapshot.arena_.blocks_ == NULL);
+  pages[page]     = 'd';
+  pages[2 * page] = 'd';
+  assert(Checkpoint_SnapshotArena(&snapshot) == SUCCESS);
+  assert(snapshot.dirty_pages_ == 2);
+  pages[page] = 'e';
+  assert(Rollback_SnapshotArena(&snapshot) == SUCCESS);
+  assert(pages[page] == 'd' && pages[2 * page] == 'd' && pages[0] == 'a');
+  pages[3 * page] = 'f';
+  assert(Release_SnapshotArena(&snapshot) == SUCCESS);
+  assert(snapshot.dirty_pages_ == 1 && pages[3 * page] == 'f');
+  assert(Rollback_SnapshotArena(&snapshot) == ERROR_INVALID_PARAMS);
+  Destroy_SnapshotArena(&snapshot);
+#endif
 
+  printf("OK\n");
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,81 @@
+#define ABERLLOC_CACHE_COLORING
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include "static_arena.h"
+
+#define THREADS           4
+#define ARENAS_PER_THREAD 64
+
+typedef struct FirstCall {
+    int    start_;
+    size_t line_size_[THREADS];
+    size_t colors_[THREADS][ARENAS_PER_THREAD];
+} FirstCall;
+
+static FirstCall FIRST_CALL;
+
+// Every thread makes its first call at the same time, then colors arenas concurrently
+static void* DetectAndColor(void* argument) {
+  size_t thread = (size_t)argument;
+  while (!__atomic_load_n(&FIRST_CALL.start_, __ATOMIC_ACQUIRE)) {
+  }
+  FIRST_CALL.line_size_[thread] = _getCacheLineSize();
+  for (int i = 0; i < ARENAS_PER_THREAD; i++) {
+    StaticArena arena;
+    assert(Init_StaticArena(&arena, _getPageSize(), 0) == SUCCESS);
+    FIRST_CALL.colors_[thread][i] = arena.color_;
+    Destroy_StaticArena(&arena);
+  }
+  return NULL;
+}
+
+int main() {
+  pthread_t threads[THREADS];
+  for (size_t i = 0; i < THREADS; i++) {
+    assert(pthread_create(&threads[i], NULL, DetectAndColor, (void*)i) == 0);
+  }
+  __atomic_store_n(&FIRST_CALL.start_, 1, __ATOMIC_RELEASE);
+  for (size_t i = 0; i < THREADS; i++) {
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+
+  // Racing first callers all get the detected line size, a power of two never below the compile time one
+  const CacheGeometry* geometry  = Get_CacheGeometry();
+  size_t               line_size = geometry->line_size_;
+  printf("CACHE LINE SIZE: %zu, L1 %zu bytes %zu ways\n", line_size, geometry->levels_[0].size_, geometry->levels_[0].ways_);
+  assert(__builtin_popcountll(line_size) == 1 && line_size >= CACHE_LINE_SIZE && _getCacheLineSize() == line_size);
+  for (size_t i = 0; i < THREADS; i++) {
+    assert(FIRST_CALL.line_size_[i] == line_size);
+  }
+
+  // Colors are line multiples within one L1 way or a page, every one handed out equally often across threads
+  size_t span = _getPageSize();
+  if (geometry->levels_[0].ways_ != 0 && geometry->levels_[0].size_ / geometry->levels_[0].ways_ < span) {
+    span = geometry->levels_[0].size_ / geometry->levels_[0].ways_;
+  }
+  size_t colors = span / line_size;
+  size_t uses[4096] = {0};
+  assert(colors > 0 && colors <= 4096 && THREADS * ARENAS_PER_THREAD % colors == 0);
+  for (size_t i = 0; i < THREADS; i++) {
+    for (size_t j = 0; j < ARENAS_PER_THREAD; j++) {
+      assert(FIRST_CALL.colors_[i][j] % line_size == 0 && FIRST_CALL.colors_[i][j] < span);
+      uses[FIRST_CALL.colors_[i][j] / line_size]++;
+    }
+  }
+  for (size_t i = 0; i < colors; i++) {
+    assert(uses[i] == THREADS * ARENAS_PER_THREAD / colors);
+  }
+
+  // On one thread they cycle a line at a time, starting over after the last color
+  for (size_t i = 0; i <= colors; i++) {
+    StaticArena arena;
+    assert(Init_StaticArena(&arena, _getPageSize(), 0) == SUCCESS);
+    assert(arena.color_ == i % colors * line_size && arena.position_ == arena.color_);
+    assert((uintptr_t)Push_StaticArena(&arena, 8) % line_size == 0);
+    Destroy_StaticArena(&arena);
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include <cassert>
+#include <coroutine>
+#include <cstdio>
+#include <thread>
+#include "coroutine_frame.hpp"
+
+struct Task {
+    struct promise_type : ArenaFramePromise {
+        int  value_ = 0;
+        Task get_return_object() { return Task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void                return_value(int value) { value_ = value; }
+        void                unhandled_exception() {}
+    };
+    std::coroutine_handle<promise_type> handle_;
+    int run() {
+      handle_.resume();
+      return handle_.promise().value_;
+    }
+    void destroy() { handle_.destroy(); }
+};
+
+static Task Plain(int x) {
+  co_return x * 2;
+}
+static Task WithArena(std::allocator_arg_t, VirtualArena*, int x) {
+  co_return x + 1;
+}
+struct Server {
+    Task Member(std::allocator_arg_t, VirtualArena*, int x) { co_return x + 3; }
+};
+
+int main() {
+  VirtualArena arena;
+  assert(Init_VirtualArena(&arena, 1024 * 1024, 0, FALSE) == SUCCESS);
+  uintptr_t base = arena.position_;
+
+  // Frames from an explicit arena, popped when destroyed from the top
+  Task first  = WithArena(std::allocator_arg, &arena, 5);
+  Task second = WithArena(std::allocator_arg, &arena, 6);
+  assert(first.run() == 6 && second.run() == 7);
+  second.destroy();
+  assert(arena.position_ > base);
+  first.destroy();
+  assert(arena.position_ == base);
+  Server server;
+  Task   member = server.Member(std::allocator_arg, &arena, 1);
+  assert(member.run() == 4 && arena.position_ > base);
+  member.destroy();
+  assert(arena.position_ == base);
+
+  // Frames from the scope's arena
+  {
+    FrameArenaScope scope(&arena);
+    Task            scoped = Plain(4);
+    assert(arena.position_ > base && scoped.run() == 8);
+    scoped.destroy();
+    assert(arena.position_ == base);
+  }
+
+  // Frames from the thread's pool are reused, also after a destroy on another thread
+  Task  pooled = Plain(1);
+  void* frame  = pooled.handle_.address();
+  assert(arena.position_ == base && pooled.run() == 2);
+  pooled.destroy();
+  Task reused = Plain(2);
+  assert(reused.handle_.address() == frame);
+  std::thread([&] {
+    assert(reused.run() == 4);
+    reused.destroy();
+  }).join();
+  Task remote = Plain(3);
+  assert(remote.handle_.address() == frame);
+  remote.destroy();
+
+  Destroy_VirtualArena(&arena);
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,108 @@
+#define ABERLLOC_GUARD_SAMPLING
+#define ABERLLOC_GUARD_RATE  1
+#define ABERLLOC_GUARD_SLOTS 2
+#include <assert.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include "static_arena.h"
+
+// Every test push sets the countdown itself, so which pushes are sampled does not depend on the random draw
+#define SAMPLE_NEXT() (GUARD_COUNTDOWN = 1)
+#define SAMPLE_NONE() (GUARD_COUNTDOWN = 1000)
+
+static GuardedSlot* Live_GuardedSlot(uint8_t* memory) {
+  for (size_t i = 0; i < ABERLLOC_GUARD_SLOTS; i++) {
+    if (GUARD_POOL.slots_[i].state_ == GUARD_STATE_LIVE && GUARD_POOL.slots_[i].memory_ == memory) {
+      return &GUARD_POOL.slots_[i];
+    }
+  }
+  return NULL;
+}
+
+static void ExitHandler(int signal_number) {
+  (void)signal_number;
+  _exit(3);
+}
+
+// Touches a sampled push after popping it in a child, with the child's stderr read back into report
+static int TouchAfterPop(int chain, char* report, size_t size) {
+  int fds[2];
+  assert(pipe(fds) == 0);
+  pid_t child = fork();
+  if (child == 0) {
+    dup2(fds[1], STDERR_FILENO);
+    if (chain) {
+      signal(SIGSEGV, ExitHandler);
+    }
+    StaticArena arena;
+    Init_StaticArena(&arena, 64 * 1024, 0);
+    SAMPLE_NEXT();
+    volatile uint8_t* mem = Push_StaticArena(&arena, 40);
+    Pop_StaticArena(&arena, 40);
+    mem[0] = 1;
+    _exit(0);
+  }
+  close(fds[1]);
+  ssize_t length                  = read(fds[0], report, size - 1);
+  report[length > 0 ? length : 0] = '\0';
+  close(fds[0]);
+  int status;
+  assert(waitpid(child, &status, 0) == child);
+  return status;
+}
+
+int main() {
+  // A touch after pop is reported, then goes on to the handler installed before the pool, the default one kills
+  // Forked before anything is sampled here, so each child maps the pool and installs the handler itself
+  char report[512];
+  int  status = TouchAfterPop(FALSE, report, sizeof(report));
+  assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV && strstr(report, "use after pop") != NULL);
+  status = TouchAfterPop(TRUE, report, sizeof(report));
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 3 && strstr(report, "use after pop") != NULL);
+
+  // A sampled push is served from a slot, right-aligned against the next guard page, and maps back to the arena
+  StaticArena arena;
+  assert(Init_StaticArena(&arena, 64 * 1024, 0) == SUCCESS);
+  SAMPLE_NONE();
+  PushNoZero_StaticArena(&arena, 24);
+  uintptr_t position = arena.position_;
+  SAMPLE_NEXT();
+  uint8_t*     sampled = Push_StaticArena(&arena, 40);
+  GuardedSlot* first   = Live_GuardedSlot(sampled);
+  assert(first != NULL && first->position_ == position && first->original_ == arena.memory_ + position);
+  assert(sampled >= GUARD_POOL.memory_ && sampled < GUARD_POOL.memory_ + GUARD_POOL.total_size_);
+  assert((uintptr_t)(sampled + 40) % _getPageSize() == 0 && arena.position_ == position + 40);
+  memset(sampled, 1, 40);
+  assert(GUARD_ADDRESS(&arena, sampled + 8) == arena.memory_ + position + 8);
+  assert(PopToAdress_StaticArena(&arena, sampled) == SUCCESS);
+  assert(arena.position_ == position && first->state_ == GUARD_STATE_PROTECTED && GUARD_POOL.live_ == 0);
+
+  // Free slots are taken first, then the one protected the longest ago
+  SAMPLE_NEXT();
+  GuardedSlot* second = Live_GuardedSlot(Push_StaticArena(&arena, 16));
+  assert(second != NULL && second != first);
+  Pop_StaticArena(&arena, 16);
+  assert(second->state_ == GUARD_STATE_PROTECTED && second->protected_at_ > first->protected_at_);
+  SAMPLE_NEXT();
+  assert(Live_GuardedSlot(Push_StaticArena(&arena, 16)) == first);
+  Pop_StaticArena(&arena, 16);
+
+  // Merging a scratch space hands its live slots to the parent, at the position the scratch starts from
+  StaticArena scratch;
+  assert(InitScratch_StaticArena(&scratch, &arena, 4096, 0) == SUCCESS);
+  uintptr_t base = scratch.memory_ - arena.memory_;
+  SAMPLE_NONE();
+  PushNoZero_StaticArena(&scratch, 8);
+  SAMPLE_NEXT();
+  uint8_t*     merged = PushNoZero_StaticArena(&scratch, 32);
+  GuardedSlot* slot   = Live_GuardedSlot(merged);
+  assert(slot != NULL && slot->arena_ == &scratch && slot->position_ == 8);
+  assert(MergeScratch_StaticArena(&scratch, &arena) == SUCCESS);
+  assert(slot->arena_ == &arena && slot->position_ == base + 8 && slot->state_ == GUARD_STATE_LIVE);
+  assert(GUARD_ADDRESS(&arena, merged) == arena.memory_ + base + 8);
+  assert(PopTo_StaticArena(&arena, base + 8) == SUCCESS && slot->state_ == GUARD_STATE_PROTECTED);
+  Destroy_StaticArena(&arena);
+
+  printf("OK\n");
+  return 0;
+}
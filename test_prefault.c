@@ -0,0 +1,59 @@
+#include <assert.h>
+#include <stdio.h>
+#include "prefault.h"
+
+#define DIRTY_SIZE (2 * PREFAULT_MIN_CHUNK + 3 * 4096 + 100)
+
+static size_t Count_Mappings(void) {
+  FILE*  maps  = fopen("/proc/self/maps", "r");
+  size_t lines = 0;
+  int    c;
+  assert(maps != NULL);
+  while ((c = fgetc(maps)) != EOF) {
+    lines += c == '\n';
+  }
+  fclose(maps);
+  return lines;
+}
+
+int main() {
+  // The linear policy keeps the commit across the pop, so the second push lands on the dirtied pages
+  VirtualArena arena;
+  ArenaPolicy  policy;
+  assert(Init_VirtualArena(&arena, 4 * PREFAULT_MIN_CHUNK, 0, FALSE) == SUCCESS);
+  assert(Init_LinearPolicy(&policy, 4 * PREFAULT_MIN_CHUNK) == SUCCESS);
+  assert(SetPolicy_VirtualArena(&arena, &policy) == SUCCESS);
+  uintptr_t position = arena.position_;
+  uint8_t*  dirty    = PushNoZero_VirtualArena(&arena, DIRTY_SIZE);
+  assert(dirty != NULL);
+  memset(dirty, 0xAB, DIRTY_SIZE);
+  size_t committed = arena.committed_size_;
+  assert(PopTo_VirtualArena(&arena, position) == SUCCESS && arena.committed_size_ == committed);
+
+  // Zeroed across every chunk, the split remainder included
+  uint8_t* mem = PushParallel_VirtualArena(&arena, DIRTY_SIZE, PREFAULT_ZERO);
+  assert(mem == dirty && arena.committed_size_ == committed);
+  for (size_t i = 0; i < DIRTY_SIZE; i++) {
+    assert(mem[i] == 0);
+  }
+
+  // Binding to the local node covers the whole reservation, pushes never split it
+  size_t mappings = Count_Mappings();
+  assert(PushParallel_VirtualArena(&arena, 100, PREFAULT_LOCAL_NODE) != NULL);
+  for (int i = 0; i < 8; i++) {
+    assert(PushParallelNoZero_VirtualArena(&arena, 4096 + 100, PREFAULT_LOCAL_NODE) != NULL);
+  }
+  assert(Count_Mappings() == mappings);
+
+  // A large block is a fresh mapping, zero without PREFAULT_ZERO
+  uint8_t* block = PushLargeBlockParallel_VirtualArena(&arena, PREFAULT_MIN_CHUNK + 100, PREFAULT_LOCAL_NODE);
+  assert(block != NULL && arena.blocks_ != NULL && arena.blocks_->memory_ == block);
+  for (size_t i = 0; i < PREFAULT_MIN_CHUNK + 100; i += 4096) {
+    assert(block[i] == 0);
+  }
+  assert(block[PREFAULT_MIN_CHUNK + 99] == 0);
+  Destroy_VirtualArena(&arena);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,53 @@
+#define ABERLLOC_PRESSURE
+#include <assert.h>
+#include <stdio.h>
+#include "virtual_arena.h"
+
+typedef struct Raised {
+    int calls_;
+    int level_;
+} Raised;
+
+static void CountRaise(void* context, int level) {
+  Raised* raised = (Raised*)context;
+  raised->calls_++;
+  raised->level_ = level;
+}
+
+int main() {
+  // Callbacks run only when the level rises
+  Raised raised = {0, PRESSURE_NONE};
+  assert(AddCallback_PressureMonitor(CountRaise, &raised) == SUCCESS);
+  SetLevel_PressureMonitor(PRESSURE_MODERATE);
+  assert(PRESSURE_LEVEL() == PRESSURE_MODERATE && raised.calls_ == 1 && raised.level_ == PRESSURE_MODERATE);
+  SetLevel_PressureMonitor(PRESSURE_MODERATE);
+  assert(raised.calls_ == 1);
+  SetLevel_PressureMonitor(PRESSURE_CRITICAL);
+  assert(raised.calls_ == 2 && raised.level_ == PRESSURE_CRITICAL);
+  SetLevel_PressureMonitor(PRESSURE_NONE);
+  assert(PRESSURE_LEVEL() == PRESSURE_NONE && raised.calls_ == 2 && PRESSURE_MONITOR.events_ == 2);
+
+  // Without pressure the geometric policy keeps the commit, under pressure pops drop to the pressure target
+  size_t       page = _getPageSize();
+  VirtualArena arena;
+  assert(Init_VirtualArena(&arena, 1024 * page, 0, FALSE) == SUCCESS);
+  uintptr_t color = arena.position_;
+  PushNoZero_VirtualArena(&arena, 40 * page);
+  size_t committed = arena.committed_size_;
+  assert(committed >= color + 40 * page);
+  PopTo_VirtualArena(&arena, color + 30 * page);
+  assert(arena.committed_size_ == committed);
+  SetLevel_PressureMonitor(PRESSURE_MODERATE);
+  PopTo_VirtualArena(&arena, color + 20 * page);
+  assert(arena.committed_size_ == pressure_commit_(committed, arena.position_));
+  assert(arena.committed_size_ == align_2pow(arena.position_ + arena.position_ / 4, page));
+  SetLevel_PressureMonitor(PRESSURE_CRITICAL);
+  PopTo_VirtualArena(&arena, color + 10 * page);
+  assert(arena.committed_size_ == align_2pow(arena.position_, page));
+  assert(raised.calls_ == 4 && raised.level_ == PRESSURE_CRITICAL);
+  SetLevel_PressureMonitor(PRESSURE_NONE);
+  Destroy_VirtualArena(&arena);
+
+  printf("OK\n");
+  return 0;
+}
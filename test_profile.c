@@ -0,0 +1,77 @@
+#define ABERLLOC_PROFILE
+#define ABERLLOC_PROFILE_INTERVAL 1
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include "static_arena.h"
+
+typedef struct ProfileTotals {
+    unsigned long long inuse_count_;
+    unsigned long long inuse_bytes_;
+    unsigned long long alloc_count_;
+    unsigned long long alloc_bytes_;
+} ProfileTotals;
+
+// Totals from the header line of a heap_v2 dump
+static ProfileTotals Dump_Totals(void) {
+  char path[] = "/tmp/aberlloc_profileXXXXXX";
+  int  fd     = mkstemp(path);
+  assert(fd >= 0 && close(fd) == 0);
+  assert(Dump_HeapProfile(path) == SUCCESS);
+  FILE*              file = fopen(path, "r");
+  ProfileTotals      totals;
+  unsigned long long interval;
+  assert(file != NULL);
+  assert(fscanf(file, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%llu", &totals.inuse_count_, &totals.inuse_bytes_,
+                &totals.alloc_count_, &totals.alloc_bytes_, &interval) == 5);
+  assert(interval == ABERLLOC_PROFILE_INTERVAL);
+  fclose(file);
+  unlink(path);
+  return totals;
+}
+
+// The first interval of a thread is drawn like every other one, at least a byte, so a 1-byte push is never sampled
+static void* PushFirstByte(void* argument) {
+  StaticArena arena;
+  (void)argument;
+  Init_StaticArena(&arena, 64 * 1024, 0);
+  Push_StaticArena(&arena, 1);
+  Destroy_StaticArena(&arena);
+  return NULL;
+}
+
+int main() {
+  pthread_t thread;
+  assert(pthread_create(&thread, NULL, PushFirstByte, NULL) == 0 && pthread_join(thread, NULL) == 0);
+  ProfileTotals totals = Dump_Totals();
+  assert(totals.alloc_count_ == 0 && totals.inuse_count_ == 0);
+
+  // Pushes far above the interval are always sampled, popping releases the ones above the position
+  StaticArena arena;
+  assert(Init_StaticArena(&arena, 64 * 1024, 0) == SUCCESS);
+  for (int i = 0; i < 3; i++) {
+    Push_StaticArena(&arena, 1000);
+  }
+  Pop_StaticArena(&arena, 1000);
+  uintptr_t position = arena.position_;
+  totals             = Dump_Totals();
+  assert(totals.inuse_count_ == 2 && totals.inuse_bytes_ == 2000 && totals.alloc_count_ == 3 && totals.alloc_bytes_ == 3000);
+
+  // A push served by a large block stays in use while the arena pops, until the block itself is freed
+  assert(Push_StaticArena(&arena, 128 * 1024) != NULL && arena.blocks_ != NULL && arena.position_ == position);
+  PopTo_StaticArena(&arena, position);
+  totals = Dump_Totals();
+  assert(totals.inuse_count_ == 3 && totals.inuse_bytes_ == 2000 + 128 * 1024 && totals.alloc_count_ == 4);
+  Pop_StaticArena(&arena, 1000);
+  totals = Dump_Totals();
+  assert(totals.inuse_count_ == 2 && totals.inuse_bytes_ == 1000 + 128 * 1024);
+  PopLargeBlock_StaticArena(&arena);
+  totals = Dump_Totals();
+  assert(totals.inuse_count_ == 1 && totals.inuse_bytes_ == 1000 && totals.alloc_bytes_ == 3000 + 128 * 1024);
+  Destroy_StaticArena(&arena);
+  totals = Dump_Totals();
+  assert(totals.inuse_count_ == 0 && totals.inuse_bytes_ == 0 && totals.alloc_count_ == 4);
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,68 @@
+#define ABERLLOC_TRACE
+#define ABERLLOC_TRACE_CAPACITY 64
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include "static_arena.h"
+
+static void* PushOnOtherThread(void* argument) {
+  StaticArena* arena = (StaticArena*)argument;
+  Init_StaticArena(arena, 64 * 1024, 0);
+  Push_StaticArena(arena, 32);
+  Destroy_StaticArena(arena);
+  return NULL;
+}
+
+int main() {
+  StaticArena arena;
+  StaticArena other;
+  pthread_t   thread;
+  assert(Init_StaticArena(&arena, 64 * 1024, 0) == SUCCESS);
+  uintptr_t color = arena.position_;
+  Push_StaticArena(&arena, 16);
+  PushNoZero_StaticArena(&arena, 24);
+  Pop_StaticArena(&arena, 24);
+  // The large block push inside is muted, only the outer push is recorded
+  assert(Push_StaticArena(&arena, 128 * 1024) != NULL);
+  // Muting this thread leaves the events of the others alone
+  TRACE_MUTE();
+  Push_StaticArena(&arena, 8);
+  assert(pthread_create(&thread, NULL, PushOnOtherThread, &other) == 0 && pthread_join(thread, NULL) == 0);
+  TRACE_UNMUTE();
+  PopTo_StaticArena(&arena, color);
+  Destroy_StaticArena(&arena);
+
+  // The dump is a header followed by the events oldest first
+  char path[] = "/tmp/aberlloc_traceXXXXXX";
+  int  fd     = mkstemp(path);
+  assert(fd >= 0 && close(fd) == 0);
+  assert(Dump_AllocTrace(path) == SUCCESS);
+  FILE*           file = fopen(path, "rb");
+  TraceFileHeader header;
+  TraceEvent      events[ABERLLOC_TRACE_CAPACITY];
+  assert(file != NULL && fread(&header, sizeof(header), 1, file) == 1);
+  assert(header.magic_ == TRACE_MAGIC && header.version_ == TRACE_VERSION && header.event_count_ == 10);
+  assert(fread(events, sizeof(TraceEvent), ABERLLOC_TRACE_CAPACITY, file) == 10);
+  fclose(file);
+  unlink(path);
+
+  TraceEvent expected[10] = {
+      {(uintptr_t)&arena, 64 * 1024, 0, TRACE_INIT, TRACE_STATIC, 0, {0}},
+      {(uintptr_t)&arena, 16, color + 16, TRACE_PUSH, TRACE_STATIC, 0, {0}},
+      {(uintptr_t)&arena, 24, color + 40, TRACE_PUSH_NO_ZERO, TRACE_STATIC, 0, {0}},
+      {(uintptr_t)&arena, 24, color + 16, TRACE_POP, TRACE_STATIC, 0, {0}},
+      {(uintptr_t)&arena, 128 * 1024, color + 16, TRACE_PUSH, TRACE_STATIC, 0, {0}},
+      {(uintptr_t)&other, 64 * 1024, 0, TRACE_INIT, TRACE_STATIC, 0, {0}},
+      {(uintptr_t)&other, 32, other.color_ + 32, TRACE_PUSH, TRACE_STATIC, 0, {0}},
+      {(uintptr_t)&other, 0, 0, TRACE_DESTROY, TRACE_STATIC, 0, {0}},
+      {(uintptr_t)&arena, 0, color, TRACE_POP_TO, TRACE_STATIC, 0, {0}},
+      {(uintptr_t)&arena, 0, 0, TRACE_DESTROY, TRACE_STATIC, 0, {0}},
+  };
+  for (int i = 0; i < 10; i++) {
+    assert(events[i].arena_ == expected[i].arena_ && events[i].op_ == expected[i].op_ && events[i].kind_ == expected[i].kind_);
+    assert(events[i].value_ == expected[i].value_ && events[i].position_ == expected[i].position_);
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,118 @@
+#ifndef _TRACE_ABERLLOC_HEADER
+#define _TRACE_ABERLLOC_HEADER
+#include <stdint.h>
+#include <stdlib.h>
+#include "./utils.h"
+// Allocation tracing, compiled in with ABERLLOC_TRACE. Every arena operation is written into an in-memory ring of
+// fixed-size binary events that can be dumped to a file and fed to the replay tool (replay.c).
+// Events carry the arena address as its identity and the arena position right after the operation, which is what
+// lets the replay map positions from the traced arena to an arena with a different configuration.
+// Not thread-safe beyond the ring index, arenas are single-threaded anyway.
+
+#define TRACE_MAGIC   0x52544241u  // "ABTR"
+#define TRACE_VERSION 1
+
+typedef enum TraceOp {
+  TRACE_INIT = 1,  // value_ is the size, position_ the auto alignment and flags_ the remapping flag
+  TRACE_DESTROY,
+  TRACE_PUSH,
+  TRACE_PUSH_NO_ZERO,
+  TRACE_POP,
+  TRACE_POP_TO,
+  TRACE_CLEAR,
+  TRACE_PUSH_LARGE_BLOCK,
+  TRACE_POP_LARGE_BLOCK,
+  TRACE_INIT_SCRATCH,     // value_ is the parent arena, position_ the scratch size, flags_ log2 of the auto alignment or 0.
+                          // The parent push is the event before
+  TRACE_MERGE_SCRATCH,    // value_ is the parent arena, position_ the parent position afterwards
+  TRACE_DESTROY_SCRATCH,  // Same as merge
+} TraceOp;
+
+typedef enum TraceKind {
+  TRACE_STATIC = 1,
+  TRACE_VIRTUAL,
+  TRACE_CHAINED,
+} TraceKind;
+
+typedef struct TraceEvent {
+    uint64_t arena_;
+    uint64_t value_;     // Bytes, sizes, or the parent arena
+    uint64_t position_;  // Position after the operation, (chunk << 48 | offset) for chained arenas
+    uint8_t  op_;
+    uint8_t  kind_;
+    uint8_t  flags_;  // Init: remapping. Init scratch: auto alignment
+    uint8_t  reserved_[5];
+} TraceEvent;
+
+typedef struct TraceFileHeader {
+    uint32_t magic_;
+    uint32_t version_;
+    uint64_t event_count_;
+} TraceFileHeader;
+
+#ifdef ABERLLOC_TRACE
+#include <stdio.h>
+
+#ifndef ABERLLOC_TRACE_CAPACITY
+#define ABERLLOC_TRACE_CAPACITY (1 << 20)  // Events, power of two. 32 MB
+#endif
+
+// Weak so that every translation unit records into the same ring, the linker keeps a single definition.
+// Muting is per thread, a thread inside a muted call must not drop the events of the others.
+__attribute__((weak)) TraceEvent TRACE_RING[ABERLLOC_TRACE_CAPACITY];
+__attribute__((weak)) uint64_t   TRACE_HEAD = 0;
+static __thread int              TRACE_MUTED = 0;
+
+static void Record_AllocTrace(uint8_t op, uint8_t kind, const void* arena, uint64_t value, uint64_t position, uint8_t flags) {
+  if (TRACE_MUTED) {
+    return;
+  }
+  uint64_t    index = __atomic_fetch_add(&TRACE_HEAD, 1, __ATOMIC_RELAXED) & (ABERLLOC_TRACE_CAPACITY - 1);
+  TraceEvent* event = &TRACE_RING[index];
+  event->arena_     = (uint64_t)(uintptr_t)arena;
+  event->value_     = value;
+  event->position_  = position;
+  event->op_        = op;
+  event->kind_      = kind;
+  event->flags_     = flags;
+}
+
+// Writes the ring oldest event first. Only the last ABERLLOC_TRACE_CAPACITY events survive, so a wrapped trace starts
+// in the middle of the program and the replay ignores operations on arenas it never saw initialised.
+int Dump_AllocTrace(const char* path) {
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+  uint64_t        head   = __atomic_load_n(&TRACE_HEAD, __ATOMIC_RELAXED);
+  uint64_t        count  = head < ABERLLOC_TRACE_CAPACITY ? head : ABERLLOC_TRACE_CAPACITY;
+  uint64_t        first  = (head - count) & (ABERLLOC_TRACE_CAPACITY - 1);
+  TraceFileHeader header = {TRACE_MAGIC, TRACE_VERSION, count};
+  int             result = fwrite(&header, sizeof(header), 1, file) == 1 ? SUCCESS : ERROR_INVALID_PARAMS;
+  uint64_t        tail   = ABERLLOC_TRACE_CAPACITY - first < count ? ABERLLOC_TRACE_CAPACITY - first : count;
+  if (result == SUCCESS && fwrite(TRACE_RING + first, sizeof(TraceEvent), tail, file) != tail) {
+    result = ERROR_INVALID_PARAMS;
+  }
+  if (result == SUCCESS && fwrite(TRACE_RING, sizeof(TraceEvent), count - tail, file) != count - tail) {
+    result = ERROR_INVALID_PARAMS;
+  }
+  fclose(file);
+  return result;
+}
+void Reset_AllocTrace(void) {
+  __atomic_store_n(&TRACE_HEAD, 0, __ATOMIC_RELAXED);
+}
+
+#define TRACE_EVENT(op, kind, arena, value, position) Record_AllocTrace(op, kind, arena, value, position, 0)
+#define TRACE_EVENT_FLAGS(op, kind, arena, value, position, flags) Record_AllocTrace(op, kind, arena, value, position, flags)
+// Around calls to other traced functions that are an implementation detail of the current one
+#define TRACE_MUTE()   (TRACE_MUTED++)
+#define TRACE_UNMUTE() (TRACE_MUTED--)
+#else
+#define TRACE_EVENT(op, kind, arena, value, position)              ((void)0)
+#define TRACE_EVENT_FLAGS(op, kind, arena, value, position, flags) ((void)0)
+#define TRACE_MUTE()                                               ((void)0)
+#define TRACE_UNMUTE()                                             ((void)0)
+#endif
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef _WIN32
 #ifdef __GNUC__
 
@@ -18,7 +19,13 @@
 #include "cache.h"
 // typedef unsigned long long size_t;
 
+#ifdef _WIN32
 static DWORD prot;
+#endif
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
 
 #define SUCCESS                0
 #define ERROR_OS_MEMORY        -1
@@ -27,15 +34,32 @@ static DWORD prot;
 #define WORD_SIZE              sizeof(void*)
 #define CROSS_THREAD_ALIGNMENT CACHE_LINE_SIZE
 
-#define SMALL_SCRATCH_SPACE    1024 * 512       // 512 kB
-#define MEDIUM_SCRATCH_SPACE   1024 * 1024 * 1  // 1 MB
-#define LARGE_SCRATCH_SPACE    1024 * 1024 * 4  // 4 MB
+#define SMALL_SCRATCH_SPACE    ((size_t)1024 * 512)       // 512 kB
+#define MEDIUM_SCRATCH_SPACE   ((size_t)1024 * 1024 * 1)  // 1 MB
+#define LARGE_SCRATCH_SPACE    ((size_t)1024 * 1024 * 4)  // 4 MB
+
+#define SMALL_SIZE_ARENA       ((size_t)1024 * 1024 * 64)    // 64 MB
+#define MEDIUM_SIZE_ARENA      ((size_t)1024 * 1024 * 256)   // 256 MB
+#define LARGE_SIZE_ARENA       ((size_t)1024 * 1024 * 1024)  // 1 GB
 
-#define SMALL_SIZE_ARENA       1024 * 1024 * 64    // 64 MB
-#define MEDIUM_SIZE_ARENA      1024 * 1024 * 256   // 256 MB
-#define LARGE_SIZE_ARENA       1024 * 1024 * 1024  // 1 GB
+#ifdef ABERLLOC_STATS
+// OS call counters, the replay tool reads them
+typedef struct OsStats {
+    size_t mappings_;
+    size_t commits_;
+    size_t uncommits_;
+    size_t advises_;
+    size_t protects_;
+    size_t frees_;
+} OsStats;
+static OsStats OS_STATS;
+#define OS_STAT(counter) (OS_STATS.counter++)
+#else
+#define OS_STAT(counter) ((void)0)
+#endif
 
 #ifdef DEBUG
+#include <stdio.h>
 #define DEBUG_PRINT(fmt, ...) fprintf(stderr, "DEBUG: %s:%d:%s(): " fmt "\n", __FILE__, __LINE__, __func__, ##__VA_ARGS__)
 #else
 #define DEBUG_PRINT(fmt, ...) ((void)0)
@@ -52,22 +76,88 @@ static uintptr_t align_2pow(uintptr_t n, uintptr_t align) {
   return (n + align - 1) & ~(align - 1);
 }
 
+// Overflow-checked size arithmetic, they return TRUE if the result does not fit and leave *result untouched
+static inline int size_add_overflow(size_t a, size_t b, size_t* result) {
+  size_t sum;
+  if (__builtin_add_overflow(a, b, &sum)) {
+    return TRUE;
+  }
+  *result = sum;
+  return FALSE;
+}
+static inline int size_mul_overflow(size_t a, size_t b, size_t* result) {
+  size_t product;
+  if (__builtin_mul_overflow(a, b, &product)) {
+    return TRUE;
+  }
+  *result = product;
+  return FALSE;
+}
+static inline int align_2pow_overflow(size_t n, size_t align, size_t* result) {
+  size_t sum;
+  if (__builtin_add_overflow(n, align - 1, &sum)) {
+    return TRUE;
+  }
+  *result = sum & ~(align - 1);
+  return FALSE;
+}
+// TRUE if [position, position + bytes) fits below limit
+static inline int fits_below(size_t position, size_t bytes, size_t limit) {
+  return position <= limit && bytes <= limit - position;
+}
+
 static size_t PAGE_SIZE = 0;
 
+// Racing first callers all store the same value, relaxed atomics are enough
 static size_t _getPageSize(void) {
-  if (!PAGE_SIZE) {
+  size_t page_size = __atomic_load_n(&PAGE_SIZE, __ATOMIC_RELAXED);
+  if (!page_size) {
 #ifdef _WIN32
     SYSTEM_INFO si;
     GetSystemInfo(&si);
-    PAGE_SIZE = si.dwPageSize;
+    page_size = si.dwPageSize;
 #else
-    PAGE_SIZE = sysconf(_SC_PAGESIZE);
+    page_size = sysconf(_SC_PAGESIZE);
 #endif
+    __atomic_store_n(&PAGE_SIZE, page_size, __ATOMIC_RELAXED);
   }
-  return PAGE_SIZE;
+  return page_size;
+}
+
+// Alignment and padding for data written by different threads, never less than CROSS_THREAD_ALIGNMENT
+static size_t _getCrossThreadAlignment(void) {
+  size_t line_size = _getCacheLineSize();
+  return line_size > CROSS_THREAD_ALIGNMENT ? line_size : CROSS_THREAD_ALIGNMENT;
 }
 
+#ifdef ABERLLOC_CACHE_COLORING
+// Arenas and large blocks all start on a page boundary, so their first lines land in the same L1 sets. With coloring
+// each new one starts a line further into the page, cycling through the sets of one L1 way (or a page, if smaller).
+// Arenas are initialised from any thread, the counter is only touched atomically.
+static size_t CACHE_COLOR_NEXT = 0;
+
+static size_t Next_CacheColor(void) {
+  const CacheGeometry* geometry = Get_CacheGeometry();
+  size_t               span     = _getPageSize();
+  if (geometry->levels_[0].ways_ != 0 && geometry->levels_[0].size_ / geometry->levels_[0].ways_ < span) {
+    span = geometry->levels_[0].size_ / geometry->levels_[0].ways_;
+  }
+  size_t colors = span / geometry->line_size_;
+  if (colors == 0) {
+    return 0;
+  }
+  return (__atomic_fetch_add(&CACHE_COLOR_NEXT, 1, __ATOMIC_RELAXED) % colors) * geometry->line_size_;
+}
+#define NEXT_CACHE_COLOR() Next_CacheColor()
+#else
+#define NEXT_CACHE_COLOR() ((size_t)0)
+#endif
+
 static uintptr_t extendPolicy(uintptr_t size) {
+  // Saturates instead of wrapping around
+  if (size > SIZE_MAX / 4) {
+    return SIZE_MAX;
+  }
   return size * 4;
 }
 static uintptr_t reducePolicy(uintptr_t size) {
@@ -77,26 +167,30 @@ static int reduceCondition(uintptr_t used_size, uintptr_t comm_size) {
   return comm_size / used_size >= 4;
 }
 static uint8_t* os_new_virtual_mapping_(size_t size) {
+  OS_STAT(mappings_);
   // We want to return ptr on success, NULL on failure
 #ifdef _WIN32
   return ((uint8_t*)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_READWRITE));
 #else
-  uint8_t* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  // No swap reservation, otherwise multi-terabyte reservations are refused by the overcommit heuristic
+  uint8_t* ptr = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
   return (ptr != MAP_FAILED) ? ptr : NULL;
 #endif
 }
 
 static uint8_t* os_new_virtual_mapping_commit(size_t size) {
+  OS_STAT(mappings_);
   // We want to return ptr on success, NULL on failure
 #ifdef _WIN32
   return ((uint8_t*)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
 #else
-  uint8_t* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  uint8_t* ptr = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
   return (ptr != MAP_FAILED) ? ptr : NULL;
 #endif
 }
 
 static int os_commit_(void* base_ptr, size_t size) {
+  OS_STAT(commits_);
 #ifdef _WIN32
   return (VirtualAlloc(base_ptr, size, MEM_COMMIT, PAGE_READWRITE) != FALSE) ? SUCCESS : ERROR_OS_MEMORY;
 #else
@@ -105,6 +199,7 @@ static int os_commit_(void* base_ptr, size_t size) {
 #endif
 }
 static int os_uncommit_(void* base_ptr, size_t size) {
+  OS_STAT(uncommits_);
 #ifdef _WIN32
   return (VirtualFree(base_ptr, size, MEM_DECOMMIT) != FALSE) ? SUCCESS : ERROR_OS_MEMORY;
 #else
@@ -113,7 +208,18 @@ static int os_uncommit_(void* base_ptr, size_t size) {
 #endif
 }
 
+static int os_advise_huge_pages_(void* base_ptr, size_t size) {
+  OS_STAT(advises_);
+#if defined(_WIN32) || !defined(MADV_HUGEPAGE)
+  // Large pages on Windows need privileges and a separate allocation path, nothing to do here
+  return SUCCESS;
+#else
+  return (madvise(base_ptr, size, MADV_HUGEPAGE) == 0) ? SUCCESS : ERROR_OS_MEMORY;
+#endif
+}
+
 static int os_protect_readonly(void* base_ptr, size_t size) {
+  OS_STAT(protects_);
 #ifdef _WIN32
   return (VirtualProtect(base_ptr, size, PAGE_READONLY, &prot) != FALSE) ? SUCCESS : ERROR_OS_MEMORY;
 #else
@@ -122,19 +228,21 @@ static int os_protect_readonly(void* base_ptr, size_t size) {
 #endif
 }
 static int os_protect_readwrite(void* base_ptr, size_t size) {
+  OS_STAT(protects_);
 #ifdef _WIN32
   return (VirtualProtect(base_ptr, size, PAGE_READWRITE, &prot) != FALSE) ? SUCCESS : ERROR_OS_MEMORY;
 #else
   // On Unix-like systems, it is more of a suggestion
-  return (mprotect(base_ptr, size, PROT_READ) == 0) ? SUCCESS : ERROR_OS_MEMORY;
+  return (mprotect(base_ptr, size, PROT_READ | PROT_WRITE) == 0) ? SUCCESS : ERROR_OS_MEMORY;
 #endif
 }
-static int os_protect_none(void* base_ptr, size_t size) {
+// Only the guard pool uses it, inline so that other units do not warn about an unused function
+static inline int os_protect_none(void* base_ptr, size_t size) {
+  OS_STAT(protects_);
 #ifdef _WIN32
   return (VirtualProtect(base_ptr, size, PAGE_NOACCESS, &prot) != FALSE) ? SUCCESS : ERROR_OS_MEMORY;
 #else
-  // On Unix-like systems, it is more of a suggestion
-  return (mprotect(base_ptr, size, PROT_READ) == 0) ? SUCCESS : ERROR_OS_MEMORY;
+  return (mprotect(base_ptr, size, PROT_NONE) == 0) ? SUCCESS : ERROR_OS_MEMORY;
 #endif
 }
 // #ifndef DEBUG
@@ -147,10 +255,11 @@ static int os_protect_none(void* base_ptr, size_t size) {
 // }
 // #else
 static int os_free_(void* base_ptr, size_t size) {
+  OS_STAT(frees_);
 #ifdef _WIN32
   return (VirtualFree(base_ptr, 0, MEM_RELEASE) == 0) ? SUCCESS : ERROR_OS_MEMORY;
 #else
-  return (munmap(arena->memory, arena_size) == 0) ? SUCCESS : ERROR_OS_MEMORY;
+  return (munmap(base_ptr, size) == 0) ? SUCCESS : ERROR_OS_MEMORY;
 #endif
 }
 // #endif
@@ -3,7 +3,12 @@
 // #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include "./guard.h"
+#include "./policy.h"
+#include "./pressure.h"
+#include "./profiler.h"
 #include "./static_arena.h"
+#include "./trace.h"
 #include "./utils.h"
 #ifdef _WIN32
 #ifdef __GNUC__
@@ -25,25 +30,29 @@ typedef struct VirtualArena {
     uintptr_t total_size_;  // Size
     // pthread_mutex_t __arena_mutex;
     int auto_align_;
-    int alignment_;
+    size_t alignment_;
     int remapping;
     // VirtualArena*    __parent;
     LargeMemBlock* blocks_;
+    ArenaPolicy*   policy_;  // Commit growth and shrink, DEFAULT_POLICY unless set
+    uintptr_t      color_;   // First position, the arena never pops below it. 0 unless built with ABERLLOC_CACHE_COLORING
 } VirtualArena;
 
-int Init_VirtualArena(VirtualArena* arena, int arena_size, int auto_align, int remapping) {
+int Init_VirtualArena(VirtualArena* arena, size_t arena_size, size_t auto_align, int remapping) {
 #ifdef DEBUG
   if (arena == NULL || arena_size < _getPageSize()) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
   arena->total_size_ = arena_size;
-  arena->position_   = 0;
+  arena->color_      = NEXT_CACHE_COLOR();
+  arena->position_   = arena->color_;
   arena->blocks_     = NULL;
   arena->remapping   = remapping;
+  arena->policy_     = &DEFAULT_POLICY;
   // arena->__parent     = NULL;
-  int word_size = WORD_SIZE;
-  if (auto_align > word_size && __builtin_popcount(auto_align) == 1) {
+  size_t word_size = WORD_SIZE;
+  if (auto_align > word_size && __builtin_popcountll(auto_align) == 1) {
     arena->auto_align_ = TRUE;
     arena->alignment_  = auto_align;
   } else {
@@ -59,6 +68,7 @@ int Init_VirtualArena(VirtualArena* arena, int arena_size, int auto_align, int r
     os_free_(arena->memory_, arena->total_size_);
     return ERROR_OS_MEMORY;
   }
+  TRACE_EVENT_FLAGS(TRACE_INIT, TRACE_VIRTUAL, arena, arena_size, auto_align, remapping);
   return SUCCESS;
 }
 // Here
@@ -68,6 +78,9 @@ int Destroy_VirtualArena(VirtualArena* arena) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
+  TRACE_EVENT(TRACE_DESTROY, TRACE_VIRTUAL, arena, 0, 0);
+  GUARD_POP(arena, 0);
+  PROFILE_POP(arena, 0);
   Destroy_LargeMemBlocks(arena->blocks_);
   if (os_free_(arena->memory_, arena->total_size_) == ERROR_OS_MEMORY) {
     DEBUG_PRINT("Freeing old virtual memory did not work during remap. Memory leaked.");
@@ -82,12 +95,12 @@ int Destroy_VirtualArena(VirtualArena* arena) {
   return SUCCESS;
 }
 
-int SetAutoAlign2Pow_VirtualArena(VirtualArena* arena, int alignment) {
+int SetAutoAlign2Pow_VirtualArena(VirtualArena* arena, size_t alignment) {
 #ifdef DEBUG
   if (arena == NULL) {
     return ERROR_INVALID_PARAMS;
   }
-  if (__builtin_popcount(alignment) != 1 || alignment < WORD_SIZE) {
+  if (__builtin_popcountll(alignment) != 1 || alignment < WORD_SIZE) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
@@ -96,18 +109,32 @@ int SetAutoAlign2Pow_VirtualArena(VirtualArena* arena, int alignment) {
   return SUCCESS;
 }
 
-uint8_t* PushLargeBlock_VirtualArena(VirtualArena* arena, int bytes) {
-  DEBUG_PRINT("Large block allocation of %d", bytes);
+int SetPolicy_VirtualArena(VirtualArena* arena, ArenaPolicy* policy) {
+#ifdef DEBUG
+  if (arena == NULL || policy == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  arena->policy_ = policy;
+  if (policy->huge_pages_ && os_advise_huge_pages_(arena->memory_, arena->total_size_) == ERROR_OS_MEMORY) {
+    DEBUG_PRINT("Huge page advice failed, continuing with regular pages");
+  }
+  return SUCCESS;
+}
+
+uint8_t* PushLargeBlock_VirtualArena(VirtualArena* arena, size_t bytes) {
+  DEBUG_PRINT("Large block allocation of %zu", bytes);
   LargeMemBlock* new_block = Create_LargeMemBlock(bytes, arena->blocks_);
   if (new_block == NULL) {
     DEBUG_PRINT("Failed large block memory allocation");
     return NULL;
   }
   arena->blocks_ = new_block;
+  TRACE_EVENT(TRACE_PUSH_LARGE_BLOCK, TRACE_VIRTUAL, arena, bytes, arena->position_);
   return new_block->memory_;
 }
 
-int ReMap_VirtualArena(VirtualArena* arena, int total_size) {
+int ReMap_VirtualArena(VirtualArena* arena, size_t total_size) {
 #ifdef DEBUG
   if (total_size < arena->committed_size_) {
     // Need to ensure there is enough space at destination of memcopy
@@ -129,21 +156,34 @@ int ReMap_VirtualArena(VirtualArena* arena, int total_size) {
   if (os_free_(arena->memory_, arena->total_size_) != 0) {
     DEBUG_PRINT("Freeing old virtual memory did not work during destruction. Memory leaked.");
   }
-  arena->memory_ = new_memory;
+  arena->memory_     = new_memory;
+  arena->total_size_ = total_size;
+  if (arena->policy_->huge_pages_) {
+    os_advise_huge_pages_(arena->memory_, arena->total_size_);
+  }
   return SUCCESS;
 }
 
-int ExtendCommit_VirtualArena(VirtualArena* arena, int total_commited_size) {
+int ExtendCommit_VirtualArena(VirtualArena* arena, size_t total_commited_size) {
 #ifdef DEBUG
   if (!arena || !total_commited_size || total_commited_size < arena->committed_size_) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
   if (total_commited_size > arena->total_size_) {
-    DEBUG_PRINT("Not enough virtual memory in the arena, remapping.");
-    if (!ReMap_VirtualArena(arena, extendPolicy(arena->total_size_))) {
-      DEBUG_PRINT("Remap failed, not enough memory.");
-      return ERROR_OS_MEMORY;
+    if (!arena->remapping) {
+      // Without remapping the commit is bounded by the reservation
+      total_commited_size = arena->total_size_;
+    } else {
+      DEBUG_PRINT("Not enough virtual memory in the arena, remapping.");
+      uintptr_t new_total_size = extendPolicy(arena->total_size_);
+      while (new_total_size < total_commited_size) {
+        new_total_size = extendPolicy(new_total_size);
+      }
+      if (ReMap_VirtualArena(arena, new_total_size) != SUCCESS) {
+        DEBUG_PRINT("Remap failed, not enough memory.");
+        return ERROR_OS_MEMORY;
+      }
     }
   }
   // We only need to extend the memory commitment under the total size.
@@ -151,10 +191,20 @@ int ExtendCommit_VirtualArena(VirtualArena* arena, int total_commited_size) {
     return ERROR_OS_MEMORY;
   }
   arena->committed_size_ = total_commited_size;
+  return SUCCESS;
+}
+// Commit up to the policy target for a push ending at end. Targets rounded past the reservation are clamped while end
+// fits, so only a push that does not fit remaps and moves the arena.
+static int ExtendCommitTo_VirtualArena(VirtualArena* arena, size_t end) {
+  size_t target = arena->policy_->extend_(arena->policy_, arena->committed_size_, end);
+  if (end <= arena->total_size_ && target > arena->total_size_) {
+    target = arena->total_size_;
+  }
+  return ExtendCommit_VirtualArena(arena, target);
 }
-int ReduceCommit_VirtualArena(VirtualArena* arena, int total_commited_size) {
+int ReduceCommit_VirtualArena(VirtualArena* arena, size_t total_commited_size) {
 #ifdef DEBUG
-  if (!arena || !total_commited_size || total_commited_size > arena->__commited_size) {
+  if (!arena || !total_commited_size || total_commited_size > arena->committed_size_) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
@@ -162,6 +212,30 @@ int ReduceCommit_VirtualArena(VirtualArena* arena, int total_commited_size) {
     return ERROR_OS_MEMORY;
   }
   arena->committed_size_ = total_commited_size;
+  return SUCCESS;
+}
+static void ShrinkCommit_VirtualArena(VirtualArena* arena, uintptr_t previous_position) {
+  // The policy decides how much of the commit survives a pop, unless memory is under pressure
+  size_t target = arena->policy_->reduce_(arena->policy_, arena->committed_size_, previous_position, arena->position_);
+  target        = pressure_commit_(target, arena->position_);
+  if (target < arena->committed_size_) {
+    if (ReduceCommit_VirtualArena(arena, target) == ERROR_OS_MEMORY) {
+      DEBUG_PRINT("Reduce commit in Virtual arena failed");
+    }
+  }
+}
+// Decommits everything above the position now, for arenas that sit idle under memory pressure
+int Trim_VirtualArena(VirtualArena* arena) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  size_t keep = arena->position_ < _getPageSize() ? _getPageSize() : align_2pow(arena->position_, _getPageSize());
+  if (keep < arena->committed_size_) {
+    return ReduceCommit_VirtualArena(arena, keep);
+  }
+  return SUCCESS;
 }
 uintptr_t GetPos_VirtualArena(VirtualArena* arena) {
 #ifdef DEBUG
@@ -172,12 +246,12 @@ uintptr_t GetPos_VirtualArena(VirtualArena* arena) {
   return arena->position_;
 }
 
-int PushAligner_VirtualArena(VirtualArena* arena, int alignment) {
+int PushAligner_VirtualArena(VirtualArena* arena, size_t alignment) {
 #ifdef DEBUG
   if (arena == NULL) {
     return ERROR_INVALID_PARAMS;
   }
-  if (__builtin_popcount(alignment) != 1 || alignment < WORD_SIZE) {
+  if (__builtin_popcountll(alignment) != 1 || alignment < WORD_SIZE) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
@@ -192,7 +266,7 @@ int PushAlignerCacheLine_VirtualArena(VirtualArena* arena) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
-  arena->position_ = align_2pow(arena->position_ + (uintptr_t)arena->memory_, CACHE_LINE_SIZE) - (uintptr_t)arena->memory_;
+  arena->position_ = align_2pow(arena->position_ + (uintptr_t)arena->memory_, _getCacheLineSize()) - (uintptr_t)arena->memory_;
   return SUCCESS;
 }
 int PushAlignerPageSize_VirtualArena(VirtualArena* arena) {
@@ -204,7 +278,7 @@ int PushAlignerPageSize_VirtualArena(VirtualArena* arena) {
   arena->position_ = align_2pow(arena->position_ + (uintptr_t)arena->memory_, _getPageSize()) - (uintptr_t)arena->memory_;
   return SUCCESS;
 }
-uint8_t* PushNoZero_VirtualArena(VirtualArena* arena, int bytes) {
+uint8_t* PushNoZero_VirtualArena(VirtualArena* arena, size_t bytes) {
 #ifdef DEBUG
   if (arena == NULL) {
     return NULL;
@@ -213,20 +287,35 @@ uint8_t* PushNoZero_VirtualArena(VirtualArena* arena, int bytes) {
   if (arena->auto_align_) {
     PushAligner_VirtualArena(arena, arena->alignment_);
   }
-  if (arena->position_ + bytes < arena->total_size_ || arena->remapping) {
-    while (arena->position_ + bytes > arena->committed_size_) {
-      if (ExtendCommit_VirtualArena(arena, extendPolicy(arena->committed_size_)) == ERROR_OS_MEMORY) {
+  size_t end;
+  if (size_add_overflow(arena->position_, bytes, &end)) {
+    DEBUG_PRINT("Push size overflows");
+    return NULL;
+  }
+  if (end <= arena->total_size_ || arena->remapping) {
+    if (end > arena->committed_size_) {
+      if (ExtendCommitTo_VirtualArena(arena, end) == ERROR_OS_MEMORY) {
         return NULL;
       }
     }
   } else {
-    return PushLargeBlock_VirtualArena(arena, bytes);
+    TRACE_MUTE();
+    uint8_t* mem = PushLargeBlock_VirtualArena(arena, bytes);
+    TRACE_UNMUTE();
+    TRACE_EVENT(TRACE_PUSH_NO_ZERO, TRACE_VIRTUAL, arena, bytes, arena->position_);
+    if (mem != NULL) {
+      PROFILE_PUSH_BLOCK(arena, arena->blocks_, bytes);
+    }
+    return mem;
   }
   uint8_t* mem = arena->memory_ + arena->position_;
+  PROFILE_PUSH(arena, arena->position_, bytes);
+  GUARD_SAMPLE(arena, arena->position_, mem, bytes, arena->alignment_);
   arena->position_ += bytes;
+  TRACE_EVENT(TRACE_PUSH_NO_ZERO, TRACE_VIRTUAL, arena, bytes, arena->position_);
   return mem;
 }
-uint8_t* Push_VirtualArena(VirtualArena* arena, int bytes) {
+uint8_t* Push_VirtualArena(VirtualArena* arena, size_t bytes) {
 #ifdef DEBUG
   if (arena == NULL) {
     return NULL;
@@ -235,24 +324,53 @@ uint8_t* Push_VirtualArena(VirtualArena* arena, int bytes) {
   if (arena->auto_align_) {
     PushAligner_VirtualArena(arena, arena->alignment_);
   }
-
-  if (arena->position_ + bytes < arena->total_size_ || arena->remapping) {
-    while (arena->position_ + bytes > arena->committed_size_) {
-      if (ExtendCommit_VirtualArena(arena, extendPolicy(arena->committed_size_)) == ERROR_OS_MEMORY) {
+  size_t end;
+  if (size_add_overflow(arena->position_, bytes, &end)) {
+    DEBUG_PRINT("Push size overflows");
+    return NULL;
+  }
+  if (end <= arena->total_size_ || arena->remapping) {
+    if (end > arena->committed_size_) {
+      if (ExtendCommitTo_VirtualArena(arena, end) == ERROR_OS_MEMORY) {
         return NULL;
       }
     }
   } else {
+    TRACE_MUTE();
     uint8_t* mem = PushLargeBlock_VirtualArena(arena, bytes);
-    memset(mem, 0, bytes);
+    TRACE_UNMUTE();
+    TRACE_EVENT(TRACE_PUSH, TRACE_VIRTUAL, arena, bytes, arena->position_);
+    if (mem != NULL) {
+      PROFILE_PUSH_BLOCK(arena, arena->blocks_, bytes);
+      memset(mem, 0, bytes);
+    }
     return mem;
   }
   uint8_t* mem = arena->memory_ + arena->position_;
+  PROFILE_PUSH(arena, arena->position_, bytes);
+  GUARD_SAMPLE(arena, arena->position_, mem, bytes, arena->alignment_);
   arena->position_ += bytes;
+  TRACE_EVENT(TRACE_PUSH, TRACE_VIRTUAL, arena, bytes, arena->position_);
   memset(mem, 0, bytes);
   return mem;
 }
 
+// For data written by one thread while others write next to it: starts on its own cache line and is padded to whole
+// lines, so that the next push cannot share one with it. Zeroed.
+uint8_t* PushCrossThread_VirtualArena(VirtualArena* arena, size_t bytes) {
+#ifdef DEBUG
+  if (arena == NULL) {
+    return NULL;
+  }
+#endif
+  size_t alignment = _getCrossThreadAlignment();
+  if (align_2pow_overflow(bytes, alignment, &bytes)) {
+    return NULL;
+  }
+  PushAligner_VirtualArena(arena, alignment);
+  return Push_VirtualArena(arena, bytes);
+}
+
 int Pop_VirtualArena(VirtualArena* arena, uintptr_t bytes) {
   // Be careful, if auto align is on, the aligner allocated bytes are unseen to you. You should use pop to position or address if autoalign
   // is on.
@@ -261,15 +379,15 @@ int Pop_VirtualArena(VirtualArena* arena, uintptr_t bytes) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
-  if (arena->position_ < bytes) {
-    bytes = arena->position_;
+  uintptr_t previous_position = arena->position_;
+  if (arena->position_ - arena->color_ < bytes) {
+    bytes = arena->position_ - arena->color_;
   }
   arena->position_ -= bytes;
-  while (arena->position_ > _getPageSize() && reduceCondition(arena->committed_size_, arena->position_)) {
-    if (ReduceCommit_VirtualArena(arena, reducePolicy(arena->committed_size_)) == ERROR_OS_MEMORY) {
-      DEBUG_PRINT("Reduce commit in Virtual arena failed");
-    }
-  }
+  GUARD_POP(arena, arena->position_);
+  PROFILE_POP(arena, arena->position_);
+  TRACE_EVENT(TRACE_POP, TRACE_VIRTUAL, arena, bytes, arena->position_);
+  ShrinkCommit_VirtualArena(arena, previous_position);
   return SUCCESS;
 }
 int PopTo_VirtualArena(VirtualArena* arena, uintptr_t position) {
@@ -278,14 +396,14 @@ int PopTo_VirtualArena(VirtualArena* arena, uintptr_t position) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
+  uintptr_t previous_position = arena->position_;
   if (position < arena->position_) {
-    arena->position_ = position;
-  }
-  while (arena->position_ > _getPageSize() && reduceCondition(arena->committed_size_, arena->position_)) {
-    if (ReduceCommit_VirtualArena(arena, reducePolicy(arena->committed_size_)) == ERROR_OS_MEMORY) {
-      DEBUG_PRINT("Reduce commit in Virtual arena failed");
-    }
+    arena->position_ = position > arena->color_ ? position : arena->color_;
   }
+  GUARD_POP(arena, arena->position_);
+  PROFILE_POP(arena, arena->position_);
+  TRACE_EVENT(TRACE_POP_TO, TRACE_VIRTUAL, arena, 0, arena->position_);
+  ShrinkCommit_VirtualArena(arena, previous_position);
   return SUCCESS;
 }
 int PopToAdress_VirtualArena(VirtualArena* arena, uint8_t* address) {
@@ -294,21 +412,23 @@ int PopToAdress_VirtualArena(VirtualArena* arena, uint8_t* address) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
-  uintptr_t final_position = address - arena->memory_;
+  address                     = GUARD_ADDRESS(arena, address);
+  uintptr_t previous_position = arena->position_;
+  uintptr_t final_position    = address - arena->memory_;
   if ((uintptr_t)(arena->memory_) < (uintptr_t)address || (uintptr_t)(arena->memory_) + arena->position_ > (uintptr_t)address) {
-    arena->position_ = final_position;
+    arena->position_ = final_position > arena->color_ ? final_position : arena->color_;
   } else {
     DEBUG_PRINT("Address is outside the memory in use in PopToAddress");
   }
-  while (arena->position_ > _getPageSize() && reduceCondition(arena->committed_size_, arena->position_)) {
-    if (ReduceCommit_VirtualArena(arena, reducePolicy(arena->committed_size_)) == ERROR_OS_MEMORY) {
-      DEBUG_PRINT("Reduce commit in Virtual arena failed");
-    }
-  }
+  GUARD_POP(arena, arena->position_);
+  PROFILE_POP(arena, arena->position_);
+  TRACE_EVENT(TRACE_POP_TO, TRACE_VIRTUAL, arena, 0, arena->position_);
+  ShrinkCommit_VirtualArena(arena, previous_position);
   return SUCCESS;
 }
 int PopLargeBlock_VirtualArena(VirtualArena* arena) {
   arena->blocks_ = Pop_LargeMemoryBlock(arena->blocks_);
+  TRACE_EVENT(TRACE_POP_LARGE_BLOCK, TRACE_VIRTUAL, arena, 0, arena->position_);
   return SUCCESS;
 }
 
@@ -318,22 +438,29 @@ int Clear_VirtualArena(VirtualArena* arena) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
-  arena->position_ = 0;
-  if (ReduceCommit_VirtualArena(arena, _getPageSize()) == ERROR_OS_MEMORY) {
-    DEBUG_PRINT("Reduce commit in Virtual arena failed");
-  }
+  uintptr_t previous_position = arena->position_;
+  arena->position_            = arena->color_;
+  GUARD_POP(arena, 0);
+  PROFILE_POP(arena, 0);
+  ShrinkCommit_VirtualArena(arena, previous_position);
   Destroy_LargeMemBlocks(arena->blocks_);
+  arena->blocks_ = NULL;
+  TRACE_EVENT(TRACE_CLEAR, TRACE_VIRTUAL, arena, 0, 0);
   return SUCCESS;
 }
 
 // Essentially, the scratch space is another arena of the same type rooted at the top pointer. Only works for static I guess.
-int InitScratch_VirtualArena(StaticArena* scratch_space, VirtualArena* parent_arena, int arena_size, int auto_align) {
+int InitScratch_VirtualArena(StaticArena* scratch_space, VirtualArena* parent_arena, size_t arena_size, size_t auto_align) {
 #ifdef DEBUG
   if (scratch_space == NULL || scratch_space == NULL) {
     return ERROR_INVALID_PARAMS;
   }
 #endif
+  GUARD_SUSPEND();
+  PROFILE_SUSPEND();
   uint8_t* mem = PushNoZero_VirtualArena(parent_arena, arena_size);
+  PROFILE_RESUME();
+  GUARD_RESUME();
   if (mem == NULL) {
     return ERROR_OS_MEMORY;
   }
@@ -342,17 +469,21 @@ int InitScratch_VirtualArena(StaticArena* scratch_space, VirtualArena* parent_ar
 
   scratch_space->total_size_ = arena_size;
   scratch_space->position_   = 0;
+  scratch_space->color_      = 0;
 
-  scratch_space->blocks_ = NULL;
+  scratch_space->blocks_      = NULL;
+  scratch_space->blocks_tail_ = NULL;
 
-  int word_size = WORD_SIZE;
-  if (auto_align > word_size && __builtin_popcount(auto_align) == 1) {
+  size_t word_size = WORD_SIZE;
+  if (auto_align > word_size && __builtin_popcountll(auto_align) == 1) {
     scratch_space->auto_align_ = TRUE;
     scratch_space->alignment_  = auto_align;
   } else {
     scratch_space->auto_align_ = FALSE;
     scratch_space->alignment_  = word_size;
   }
+  TRACE_EVENT_FLAGS(TRACE_INIT_SCRATCH, TRACE_STATIC, scratch_space, (uintptr_t)parent_arena, arena_size,
+                    scratch_space->auto_align_ ? __builtin_ctzll(scratch_space->alignment_) : 0);
   return SUCCESS;
 }
 int DestroyScratch_VirtualArena(StaticArena* scratch_space, VirtualArena* parent_arena) {
@@ -364,9 +495,13 @@ int DestroyScratch_VirtualArena(StaticArena* scratch_space, VirtualArena* parent
   // Null properties and pop memory
   parent_arena->position_ -= scratch_space->total_size_;
   scratch_space->memory_ = NULL;
+  GUARD_POP(scratch_space, 0);
+  PROFILE_POP(scratch_space, 0);
+  TRACE_EVENT(TRACE_DESTROY_SCRATCH, TRACE_STATIC, scratch_space, (uintptr_t)parent_arena, parent_arena->position_);
 
   Destroy_LargeMemBlocks(scratch_space->blocks_);
-  scratch_space->blocks_ = NULL;
+  scratch_space->blocks_      = NULL;
+  scratch_space->blocks_tail_ = NULL;
 
   scratch_space->total_size_ = 0;
   scratch_space->position_   = 0;
@@ -378,11 +513,15 @@ int MergeScratch_VirtualArena(StaticArena* scratch_space, VirtualArena* parent_a
   // Merger must run under locked mutex of parent to make sure of correct behaviour.
   // Set the new position to conserve the memory from the scratch space and null properties
   // No need to do bounds check as the memory addresses must be properly ordered, and the position too.
+  GUARD_MERGE(scratch_space, parent_arena, (uintptr_t)scratch_space->memory_ - (uintptr_t)parent_arena->memory_);
+  PROFILE_MERGE(scratch_space, parent_arena, (uintptr_t)scratch_space->memory_ - (uintptr_t)parent_arena->memory_);
   parent_arena->position_ = ((uintptr_t)scratch_space->memory_ - (uintptr_t)parent_arena->memory_) + scratch_space->position_;
   scratch_space->memory_  = NULL;
+  TRACE_EVENT(TRACE_MERGE_SCRATCH, TRACE_STATIC, scratch_space, (uintptr_t)parent_arena, parent_arena->position_);
 
-  parent_arena->blocks_  = Merge_LargeMemBlocks(scratch_space->blocks_, parent_arena->blocks_);
-  scratch_space->blocks_ = NULL;
+  parent_arena->blocks_       = Splice_LargeMemBlocks(scratch_space->blocks_, scratch_space->blocks_tail_, parent_arena->blocks_);
+  scratch_space->blocks_      = NULL;
+  scratch_space->blocks_tail_ = NULL;
 
   scratch_space->total_size_ = 0;
   scratch_space->position_   = 0;
@@ -391,4 +530,69 @@ int MergeScratch_VirtualArena(StaticArena* scratch_space, VirtualArena* parent_a
   return SUCCESS;
 }
 
+// Fork-join scratch spaces over the reserve left in the parent, see InitScratches_StaticArena. The split is committed
+// like any push, the merge hands back what the policy does not keep.
+int DestroyScratches_VirtualArena(StaticArena* scratches, size_t count, VirtualArena* parent_arena) {
+#ifdef DEBUG
+  if (scratches == NULL || parent_arena == NULL) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  uintptr_t previous_position = parent_arena->position_;
+  while (count > 0) {
+    DestroyScratch_VirtualArena(&scratches[--count], parent_arena);
+  }
+  ShrinkCommit_VirtualArena(parent_arena, previous_position);
+  return SUCCESS;
+}
+int InitScratches_VirtualArena(StaticArena* scratches, size_t count, VirtualArena* parent_arena, size_t auto_align) {
+#ifdef DEBUG
+  if (scratches == NULL || parent_arena == NULL || count == 0) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  // A failure leaves the parent where it was, the alignment padding included
+  uintptr_t position  = parent_arena->position_;
+  size_t    alignment = scratches_alignment_(parent_arena->auto_align_, parent_arena->alignment_);
+  PushAligner_VirtualArena(parent_arena, alignment);
+  size_t arena_size = scratches_size_(parent_arena->position_, parent_arena->total_size_, count, alignment);
+  if (arena_size == 0) {
+    parent_arena->position_ = position;
+    return ERROR_OS_MEMORY;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (InitScratch_VirtualArena(&scratches[i], parent_arena, arena_size, auto_align) != SUCCESS) {
+      DestroyScratches_VirtualArena(scratches, i, parent_arena);
+      parent_arena->position_ = position;
+      return ERROR_OS_MEMORY;
+    }
+  }
+  return SUCCESS;
+}
+int MergeScratches_VirtualArena(StaticArena* scratches, size_t count, VirtualArena* parent_arena, uintptr_t* offsets) {
+#ifdef DEBUG
+  if (scratches == NULL || parent_arena == NULL || count == 0) {
+    return ERROR_INVALID_PARAMS;
+  }
+#endif
+  size_t    alignment         = scratches_alignment_(parent_arena->auto_align_, parent_arena->alignment_);
+  uintptr_t previous_position = parent_arena->position_;
+  uintptr_t position          = (uintptr_t)scratches[0].memory_ - (uintptr_t)parent_arena->memory_;
+  for (size_t i = 0; i < count; i++) {
+    StaticArena* scratch_space = &scratches[i];
+    uintptr_t    base = align_2pow(position + (uintptr_t)parent_arena->memory_, alignment) - (uintptr_t)parent_arena->memory_;
+    GUARD_MERGE(scratch_space, parent_arena, base);
+    PROFILE_MERGE(scratch_space, parent_arena, base);
+    if (offsets != NULL) {
+      offsets[i] = base;
+    }
+    position                = base + scratch_space->position_;
+    parent_arena->position_ = position;
+    TRACE_EVENT(TRACE_MERGE_SCRATCH, TRACE_STATIC, scratch_space, (uintptr_t)parent_arena, parent_arena->position_);
+    compact_scratch_(scratch_space, parent_arena->memory_ + base, &parent_arena->blocks_);
+  }
+  ShrinkCommit_VirtualArena(parent_arena, previous_position);
+  return SUCCESS;
+}
+
 #endif
\ No newline at end of file